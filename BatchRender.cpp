@@ -0,0 +1,666 @@
+// Batch renderer for (training/audition) datasets: renders every parameter
+// combination of a sweep specification through the SawtoothSynth engine,
+// in parallel on all cores, into a single memory-mapped output file.
+//
+// Usage: DrMixAISynthBatch <spec file> <output file> [-j threads] [-k kernels]
+//
+// The DSP kernels default to "generic", so the same spec renders the same
+// dataset on any machine. The SIMD kernels are faster, but their output
+// differs slightly (see DSPKernels.h). The kernels are recorded in the
+// output file, and resuming with other kernels is refused.
+//
+// Build: nmake batch (Windows), or
+// c++ -O2 -std=c++11 -pthread -D WDL_DENORMAL_WANTS_SCOPED_FTZ -I . BatchRender.cpp -o DrMixAISynthBatch
+//
+// The sweep specification is a text file with one setting per line (# starts
+// a comment):
+//
+//   mode grid|random       Cartesian product, or random combinations
+//   count 1000             Number of random combinations (random mode)
+//   seed 1                 Random seed (random mode)
+//   notes 36 48 60         MIDI notes
+//   length 1.0             Note on time (seconds)
+//   tail 0.5               Time after note off (seconds)
+//   samplerate 44100
+//   blocksize 512          Host block size to emulate
+//   param <name> <value>                  Fixed value
+//   param <name> <min> <max> [<steps>]    Grid steps (exponentially spaced
+//                                         for exponential params), or random
+//                                         range
+//
+// Param names are the plugin's (see kSynthParams), without spaces: Bypass,
+// Envelope, Attack, Decay, Sustain, Release, Cutoff, Resonance, LFORate, and
+// LFODepth, in the same units as the plugin's parameters (ms, dB, Hz). Params
+// not in the spec use the plugin's defaults.
+//
+// The output file starts with a BatchHeader, followed by a BatchIndexEntry
+// per render, followed by the renders (mono, 32-bit float, all the same
+// length). If the output file already exists and was created from the same
+// spec, rendering resumes where it left off, any other existing file is left
+// untouched.
+
+#include "WDL/denormal.h"
+
+#include "SawtoothSynth.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#pragma pack(push, 4)
+
+struct BatchHeader
+{
+  char magic[8]; // "DRMXBAT1"
+  uint32_t headerSize;
+  uint32_t indexEntrySize;
+  uint64_t specHash;
+  char kernels[16]; // DSPKernels name, e.g. "generic"
+
+  uint32_t numRenders;
+  uint32_t numFrames;
+  uint32_t sampleRate;
+  uint32_t numParams;
+
+  uint64_t indexOffset;
+  uint64_t dataOffset;
+};
+
+struct BatchIndexEntry
+{
+  uint32_t done; // Written last
+  int32_t note;
+  float params[kNumSynthParams];
+  uint64_t offset; // Of samples, in bytes from start of file
+};
+
+#pragma pack(pop)
+
+struct SweepParam
+{
+  double minValue, maxValue;
+  int steps;
+};
+
+struct SweepSpec
+{
+  SweepSpec() :
+    random(false),
+    count(0),
+    seed(1),
+    length(1.0),
+    tail(0.5),
+    sampleRate(44100),
+    blockSize(512)
+  {
+    for (int i = 0; i < kNumSynthParams; i++)
+    {
+      params[i].minValue = params[i].maxValue = kSynthParams[i].defaultValue;
+      params[i].steps = 1;
+    }
+  }
+
+  bool random;
+  int count;
+  uint64_t seed;
+
+  std::vector<int> notes;
+  double length, tail;
+  int sampleRate, blockSize;
+
+  SweepParam params[kNumSynthParams];
+
+  int NumFrames() const { return (int)((length + tail) * sampleRate + 0.5); }
+
+  int NumRenders() const
+  {
+    if (random) return count;
+
+    double n = (double)notes.size();
+    for (int i = 0; i < kNumSynthParams; i++) n *= params[i].steps;
+    return n < 2147483647.0 ? (int)n : -1;
+  }
+};
+
+// Case insensitive, and ignoring spaces in the param name.
+static bool NameEquals(const char *name, const char *paramName)
+{
+  for (;; name++, paramName++)
+  {
+    while (*paramName == ' ') paramName++;
+    if (tolower((unsigned char)*name) != tolower((unsigned char)*paramName)) return false;
+    if (!*name) return true;
+  }
+}
+
+static bool ParseSpec(const char *text, SweepSpec *pSpec)
+{
+  std::vector<char> buf(text, text + strlen(text) + 1);
+
+  int lineNum = 0;
+  for (char *line = strtok(&buf[0], "\r\n"); line; line = strtok(NULL, "\r\n"))
+  {
+    lineNum++;
+
+    char *comment = strchr(line, '#');
+    if (comment) *comment = 0;
+
+    char key[32], name[32];
+    double v[3];
+    int n;
+
+    if (sscanf(line, " %31s", key) != 1) continue;
+
+    if (!strcmp(key, "mode") && sscanf(line, " %*s %31s", name) == 1 && (!strcmp(name, "grid") || !strcmp(name, "random")))
+    {
+      pSpec->random = !strcmp(name, "random");
+    }
+    else if (!strcmp(key, "count") && sscanf(line, " %*s %d", &pSpec->count) == 1 && pSpec->count > 0) {}
+    else if (!strcmp(key, "seed") && sscanf(line, " %*s %lf", &v[0]) == 1) { pSpec->seed = (uint64_t)v[0]; }
+    else if (!strcmp(key, "length") && sscanf(line, " %*s %lf", &pSpec->length) == 1 && pSpec->length >= 0) {}
+    else if (!strcmp(key, "tail") && sscanf(line, " %*s %lf", &pSpec->tail) == 1 && pSpec->tail >= 0) {}
+    else if (!strcmp(key, "samplerate") && sscanf(line, " %*s %d", &pSpec->sampleRate) == 1 && pSpec->sampleRate > 0) {}
+    else if (!strcmp(key, "blocksize") && sscanf(line, " %*s %d", &pSpec->blockSize) == 1 && pSpec->blockSize > 0) {}
+    else if (!strcmp(key, "notes"))
+    {
+      const char *p = line + strlen(key) + (line[strlen(key)] ? 1 : 0);
+      for (;;)
+      {
+        int note, len;
+        if (sscanf(p, " %d%n", &note, &len) != 1) break;
+        if (note < 0 || note > 127) break;
+        pSpec->notes.push_back(note);
+        p += len;
+      }
+    }
+    else if (!strcmp(key, "param") && (n = sscanf(line, " %*s %31s %lf %lf %lf", name, &v[0], &v[1], &v[2])) >= 2)
+    {
+      int idx = 0;
+      while (idx < kNumSynthParams && !NameEquals(name, kSynthParams[idx].name)) idx++;
+      if (idx == kNumSynthParams)
+      {
+        fprintf(stderr, "Spec line %d: Unknown param \"%s\"\n", lineNum, name);
+        return false;
+      }
+
+      SweepParam *pParam = &pSpec->params[idx];
+      pParam->minValue = v[0];
+      pParam->maxValue = n >= 3 ? v[1] : v[0];
+      pParam->steps = n >= 4 ? (int)v[2] : (n >= 3 ? 2 : 1);
+
+      const SynthParamInfo *pInfo = &kSynthParams[idx];
+      if (pParam->minValue < pInfo->minValue || pParam->maxValue > pInfo->maxValue || pParam->minValue > pParam->maxValue || pParam->steps < 1)
+      {
+        fprintf(stderr, "Spec line %d: Invalid range for param %s (%g..%g)\n", lineNum, pInfo->name, pInfo->minValue, pInfo->maxValue);
+        return false;
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Spec line %d: Syntax error\n", lineNum);
+      return false;
+    }
+  }
+
+  if (pSpec->notes.empty()) pSpec->notes.push_back(60);
+
+  if (pSpec->random && !pSpec->count)
+  {
+    fprintf(stderr, "Spec: Random mode needs count\n");
+    return false;
+  }
+
+  return true;
+}
+
+// FNV-1a
+static uint64_t HashSpec(const char *text)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (const unsigned char *p = (const unsigned char*)text; *p; p++)
+  {
+    hash = (hash ^ *p) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// SplitMix64, seeded per render, so renders don't depend on thread timing
+// or resuming.
+class RenderRandom
+{
+public:
+  RenderRandom(uint64_t seed, uint64_t index) : m_state(seed ^ (index * 0x9E3779B97F4A7C15ULL)) {}
+
+  double Uniform() { return (double)(Next() >> 11) * (1.0 / 9007199254740992.0); }
+
+private:
+  uint64_t Next()
+  {
+    uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  uint64_t m_state;
+};
+
+static double ParamValue(int idx, const SweepParam *pParam, double t)
+{
+  if (kSynthParams[idx].type == kSynthParamBool) return t < 0.5 ? pParam->minValue : pParam->maxValue;
+
+  if (kSynthParams[idx].type == kSynthParamExp && pParam->minValue > 0.0)
+  {
+    return pParam->minValue * pow(pParam->maxValue / pParam->minValue, t);
+  }
+
+  return pParam->minValue + (pParam->maxValue - pParam->minValue) * t;
+}
+
+// Note and param values of render index.
+static void Combination(const SweepSpec *pSpec, int index, int *pNote, double *pValues)
+{
+  if (pSpec->random)
+  {
+    RenderRandom rnd(pSpec->seed, index);
+
+    for (int i = 0; i < kNumSynthParams; i++)
+    {
+      const SweepParam *pParam = &pSpec->params[i];
+      pValues[i] = pParam->steps > 1 || pParam->minValue != pParam->maxValue ? ParamValue(i, pParam, rnd.Uniform()) : pParam->minValue;
+    }
+
+    int n = (int)(rnd.Uniform() * pSpec->notes.size());
+    *pNote = pSpec->notes[n < (int)pSpec->notes.size() ? n : 0];
+  }
+  else
+  {
+    // Mixed radix, notes vary fastest
+    int n = (int)pSpec->notes.size();
+    *pNote = pSpec->notes[index % n];
+    index /= n;
+
+    for (int i = 0; i < kNumSynthParams; i++)
+    {
+      const SweepParam *pParam = &pSpec->params[i];
+      int step = index % pParam->steps;
+      index /= pParam->steps;
+
+      pValues[i] = pParam->steps > 1 ? ParamValue(i, pParam, (double)step / (pParam->steps - 1)) : pParam->minValue;
+    }
+  }
+}
+
+// Same as DrMixAISynth::OnParamChange()/ProcessDoubleReplacing() on a freshly
+// loaded plugin instance (call with the same floating point mode, see main()).
+static void Render(const SweepSpec *pSpec, const DSPKernels *dsp, int note, const double *pValues, float *pOutput, double *pBlock)
+{
+  SawtoothSynth synth(pSpec->sampleRate);
+  synth.SetKernels(dsp);
+
+  for (int i = 0; i < kNumSynthParams; i++) synth.SetParam(i, pValues[i], false);
+
+  bool bypass = pValues[kSynthBypass] >= 0.5;
+  bool envelope = pValues[kSynthEnvelope] >= 0.5;
+
+  synth.SetFrequency(pow(2, (double)(note - 69) / 12) * 440);
+  synth.Attack();
+
+  const int numFrames = pSpec->NumFrames();
+  const int noteOff = (int)(pSpec->length * pSpec->sampleRate + 0.5);
+
+  for (int offset = 0; offset < numFrames;)
+  {
+    int block = numFrames - offset < pSpec->blockSize ? numFrames - offset : pSpec->blockSize;
+    if (offset < noteOff && offset + block > noteOff) block = noteOff - offset;
+
+    bool gate = !bypass && (offset < noteOff || envelope);
+    synth.Process(pBlock, block, gate);
+
+    for (int i = 0; i < block; i++) pOutput[offset + i] = (float)pBlock[i];
+    offset += block;
+  }
+}
+
+class MappedFile
+{
+public:
+  MappedFile() : m_data(NULL), m_size(0)
+  {
+    #ifdef _WIN32
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+    #else
+    m_fd = -1;
+    #endif
+  }
+
+  ~MappedFile() { Close(); }
+
+  // Maps an existing file at its current size (returned in *pSize), or
+  // creates a new one of *pSize bytes (and sets *pCreated). An existing
+  // file is never resized, so pointing this at the wrong file can't damage
+  // it. An empty existing file isn't mapped (Data() is NULL).
+  bool Open(const char *path, uint64_t *pSize, bool *pCreated)
+  {
+    *pCreated = false;
+
+    #ifdef _WIN32
+    m_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE && GetLastError() == ERROR_FILE_NOT_FOUND)
+    {
+      m_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+      *pCreated = m_file != INVALID_HANDLE_VALUE;
+    }
+    if (m_file == INVALID_HANDLE_VALUE) return false;
+
+    // Mapping a new file sets its size
+    if (!*pCreated)
+    {
+      LARGE_INTEGER existing;
+      if (!GetFileSizeEx(m_file, &existing)) return false;
+      *pSize = existing.QuadPart;
+    }
+
+    const uint64_t size = *pSize;
+    if (!size) return true;
+    if (size > (uint64_t)(SIZE_T)-1) return false;
+
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, NULL);
+    if (!m_mapping) return false;
+
+    m_data = (char*)MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+    #else
+    m_fd = open(path, O_RDWR);
+    if (m_fd < 0 && errno == ENOENT)
+    {
+      m_fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+      *pCreated = m_fd >= 0;
+    }
+    if (m_fd < 0) return false;
+
+    if (*pCreated)
+    {
+      if (*pSize > (uint64_t)(size_t)-1 || ftruncate(m_fd, (off_t)*pSize)) return false;
+    }
+    else
+    {
+      struct stat st;
+      if (fstat(m_fd, &st)) return false;
+      *pSize = st.st_size;
+    }
+
+    const uint64_t size = *pSize;
+    if (!size) return true;
+    if (size > (uint64_t)(size_t)-1) return false;
+
+    void *data = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    m_data = data != MAP_FAILED ? (char*)data : NULL;
+    #endif
+
+    m_size = size;
+    return m_data != NULL;
+  }
+
+  void Close()
+  {
+    #ifdef _WIN32
+    if (m_data)
+    {
+      FlushViewOfFile(m_data, 0);
+      UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+    #else
+    if (m_data)
+    {
+      msync(m_data, (size_t)m_size, MS_SYNC);
+      munmap(m_data, (size_t)m_size);
+    }
+    if (m_fd >= 0) close(m_fd);
+    m_fd = -1;
+    #endif
+
+    m_data = NULL;
+  }
+
+  char *Data() const { return m_data; }
+
+private:
+  char *m_data;
+  uint64_t m_size;
+
+  #ifdef _WIN32
+  HANDLE m_file, m_mapping;
+  #else
+  int m_fd;
+  #endif
+};
+
+static char *ReadTextFile(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f) return NULL;
+
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  char *text = (char*)malloc(size + 1);
+  if (text && fread(text, 1, size, f) == (size_t)size)
+  {
+    text[size] = 0;
+  }
+  else
+  {
+    free(text);
+    text = NULL;
+  }
+
+  fclose(f);
+  return text;
+}
+
+int main(int argc, char **argv)
+{
+  const char *specPath = NULL, *outputPath = NULL;
+  int numThreads = (int)std::thread::hardware_concurrency();
+  const DSPKernels *dsp = DSPKernels::Get(kDSPKernelsGeneric);
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-j") && i + 1 < argc)
+    {
+      numThreads = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "-k") && i + 1 < argc)
+    {
+      dsp = DSPKernels::Find(argv[++i]);
+      if (!dsp)
+      {
+        fprintf(stderr, "Kernels \"%s\" not supported\n", argv[i]);
+        return 1;
+      }
+    }
+    else if (!specPath) specPath = argv[i];
+    else if (!outputPath) outputPath = argv[i];
+    else specPath = NULL;
+  }
+
+  if (!specPath || !outputPath)
+  {
+    fprintf(stderr, "Usage: %s <spec file> <output file> [-j threads] [-k kernels]\n", argv[0]);
+    return 1;
+  }
+
+  if (numThreads < 1) numThreads = 1;
+
+  char *text = ReadTextFile(specPath);
+  if (!text)
+  {
+    fprintf(stderr, "Can't read %s\n", specPath);
+    return 1;
+  }
+
+  SweepSpec spec;
+  bool ok = ParseSpec(text, &spec);
+  uint64_t specHash = HashSpec(text);
+  free(text);
+  if (!ok) return 1;
+
+  const int numRenders = spec.NumRenders();
+  const int numFrames = spec.NumFrames();
+  if (numRenders <= 0 || numFrames <= 0)
+  {
+    fprintf(stderr, "Nothing to render (or too many renders)\n");
+    return 1;
+  }
+
+  const uint64_t indexOffset = sizeof(BatchHeader);
+  const uint64_t dataOffset = (indexOffset + (uint64_t)numRenders * sizeof(BatchIndexEntry) + 4095) & ~(uint64_t)4095;
+  const uint64_t renderSize = (uint64_t)numFrames * sizeof(float);
+  const uint64_t fileSize = dataOffset + numRenders * renderSize;
+
+  BatchHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "DRMXBAT1", 8);
+  header.headerSize = sizeof(BatchHeader);
+  header.indexEntrySize = sizeof(BatchIndexEntry);
+  header.specHash = specHash;
+  strncpy(header.kernels, dsp->name, sizeof(header.kernels) - 1);
+  header.numRenders = numRenders;
+  header.numFrames = numFrames;
+  header.sampleRate = spec.sampleRate;
+  header.numParams = kNumSynthParams;
+  header.indexOffset = indexOffset;
+  header.dataOffset = dataOffset;
+
+  MappedFile file;
+  uint64_t size = fileSize;
+  bool created;
+  if (!file.Open(outputPath, &size, &created))
+  {
+    fprintf(stderr, "Can't map %s (%.1f MB)\n", outputPath, size / 1048576.0);
+    return 1;
+  }
+
+  BatchHeader *pHeader = (BatchHeader*)file.Data();
+  BatchIndexEntry *pIndex = (BatchIndexEntry*)(file.Data() + indexOffset);
+
+  // Resume if this is an (interrupted) run of the same spec
+  int numDone = 0;
+  if (!created)
+  {
+    if (size >= sizeof(header) && !memcmp(pHeader->magic, header.magic, sizeof(header.magic)) && strncmp(pHeader->kernels, header.kernels, sizeof(header.kernels)))
+    {
+      fprintf(stderr, "%s was rendered with %.*s kernels (resume with -k %.*s)\n", outputPath, (int)sizeof(pHeader->kernels), pHeader->kernels, (int)sizeof(pHeader->kernels), pHeader->kernels);
+      return 1;
+    }
+
+    if (size != fileSize || memcmp(pHeader, &header, sizeof(header)))
+    {
+      fprintf(stderr, "%s exists, but doesn't match the spec\n", outputPath);
+      return 1;
+    }
+
+    for (int i = 0; i < numRenders; i++) numDone += pIndex[i].done ? 1 : 0;
+    printf("Resuming, %d of %d renders done\n", numDone, numRenders);
+  }
+  else
+  {
+    *pHeader = header;
+  }
+
+  printf("Rendering %d x %.2f s at %d Hz on %d threads (%s kernels)\n", numRenders - numDone, (double)numFrames / spec.sampleRate, spec.sampleRate, numThreads, dsp->name);
+  fflush(stdout);
+
+  std::atomic<int> next(0), rendered(0);
+  std::vector<std::thread> threads;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  for (int t = 0; t < numThreads; t++)
+  {
+    threads.push_back(std::thread([&]()
+    {
+      // Same floating point mode as the plugin's audio thread, or else the
+      // results would differ (and decaying tails would be a lot slower)
+      #ifdef WDL_DENORMAL_FTZMODE
+      WDL_denormal_ftz_scope denormalFtz;
+      #endif
+
+      std::vector<double> block(spec.blockSize);
+
+      for (;;)
+      {
+        int i = next.fetch_add(1);
+        if (i >= numRenders) break;
+
+        BatchIndexEntry *pEntry = &pIndex[i];
+        if (pEntry->done) continue;
+
+        int note;
+        double values[kNumSynthParams];
+        Combination(&spec, i, &note, values);
+
+        pEntry->note = note;
+        for (int j = 0; j < kNumSynthParams; j++) pEntry->params[j] = (float)values[j];
+        pEntry->offset = dataOffset + i * renderSize;
+
+        Render(&spec, dsp, note, values, (float*)(file.Data() + pEntry->offset), &block[0]);
+
+        // Only marked done once the samples are in the (mapped) file, so an
+        // interrupted render is simply redone when resuming
+        std::atomic_thread_fence(std::memory_order_release);
+        pEntry->done = 1;
+
+        rendered.fetch_add(1, std::memory_order_relaxed);
+      }
+    }));
+  }
+
+  // Progress, once a second
+  for (int tick = 1;; tick++)
+  {
+    int total = numRenders - numDone;
+    int n = rendered.load(std::memory_order_relaxed);
+    if (n >= total) break;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (tick % 10) continue;
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "\r%d/%d, %.1f renders/sec  ", n, total, n / elapsed);
+  }
+
+  for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  int n = rendered.load();
+
+  fprintf(stderr, "\n");
+  printf("%d renders in %.2f s: %.1f renders/sec (%.0fx realtime)\n", n, elapsed, n / elapsed, n * ((double)numFrames / spec.sampleRate) / elapsed);
+
+  file.Close();
+  return 0;
+}
@@ -0,0 +1,289 @@
+#pragma once
+
+// Adaptive CPU budget governor: measures the time spent in the audio
+// callback against the block deadline, and steps the synth's quality tier
+// down under pressure, and back up (with hysteresis) when there is headroom.
+// Tier changes are logged to a lock-free queue, which is written as CSV to
+// the file in the DRMIX_GOVERNOR_LOG environment variable (if set), one
+// file for all plugin instances.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "SawtoothSynth.h" // EQualityTier
+
+struct CPUGovernorDecision
+{
+  double time; // Seconds since start
+  unsigned int block;
+  float load; // Smoothed callback time / deadline
+  int fromTier, toTier;
+};
+
+// Single producer (audio thread), single consumer ring buffer, drops
+// decisions if the consumer falls behind.
+class CPUGovernorLog
+{
+public:
+  CPUGovernorLog() : m_read(0), m_write(0), m_instance(0)
+  {
+    const char *path = getenv("DRMIX_GOVERNOR_LOG");
+    if (path && *path) m_instance = CPUGovernorLogWriter::Get().Add(this, path);
+  }
+
+  ~CPUGovernorLog()
+  {
+    if (m_instance) CPUGovernorLogWriter::Get().Remove(this);
+  }
+
+  // Audio thread, wait-free.
+  void Push(const CPUGovernorDecision &decision)
+  {
+    unsigned int write = m_write.load(std::memory_order_relaxed);
+    if (write - m_read.load(std::memory_order_acquire) >= kSize) return;
+
+    m_decisions[write & (kSize - 1)] = decision;
+    m_write.store(write + 1, std::memory_order_release);
+  }
+
+  // Any other (single) thread.
+  bool Pop(CPUGovernorDecision *pDecision)
+  {
+    unsigned int read = m_read.load(std::memory_order_relaxed);
+    if (read == m_write.load(std::memory_order_acquire)) return false;
+
+    *pDecision = m_decisions[read & (kSize - 1)];
+    m_read.store(read + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Numbered from 1 in order of creation, 0 if not logging.
+  int Instance() const { return m_instance; }
+
+private:
+  // All instances (in this process) log to the same file, with a single
+  // header, and a column to tell them apart. One thread writes it.
+  class CPUGovernorLogWriter
+  {
+  public:
+    static CPUGovernorLogWriter &Get()
+    {
+      static CPUGovernorLogWriter writer;
+      return writer;
+    }
+
+    // Returns the instance number, or 0 if the file can't be opened.
+    int Add(CPUGovernorLog *pLog, const char *path)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+
+      if (!m_file)
+      {
+        if (!(m_file = fopen(path, "a"))) return 0;
+
+        // Append to an existing log without repeating the header
+        fseek(m_file, 0, SEEK_END);
+        if (!ftell(m_file)) fprintf(m_file, "instance,time,block,load,from,to\n");
+
+        m_quit = false;
+        m_thread = std::thread(&CPUGovernorLogWriter::Run, this);
+      }
+
+      m_logs.push_back(pLog);
+      return ++m_instances;
+    }
+
+    void Remove(CPUGovernorLog *pLog)
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+
+      Drain(pLog);
+      m_logs.erase(std::find(m_logs.begin(), m_logs.end(), pLog));
+      if (!m_logs.empty()) return;
+
+      m_quit = true;
+      lock.unlock();
+
+      m_cond.notify_one();
+      m_thread.join();
+
+      fclose(m_file);
+      m_file = NULL;
+    }
+
+  private:
+    CPUGovernorLogWriter() : m_file(NULL), m_instances(0), m_quit(false) {}
+
+    void Run()
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (!m_quit)
+      {
+        m_cond.wait_for(lock, std::chrono::milliseconds(250));
+        for (size_t i = 0; i < m_logs.size(); i++) Drain(m_logs[i]);
+      }
+    }
+
+    // With m_mutex locked.
+    void Drain(CPUGovernorLog *pLog)
+    {
+      CPUGovernorDecision d;
+      bool flush = false;
+
+      while (pLog->Pop(&d))
+      {
+        fprintf(m_file, "%d,%.6f,%u,%.3f,%d,%d\n", pLog->Instance(), d.time, d.block, d.load, d.fromTier, d.toTier);
+        flush = true;
+      }
+
+      if (flush) fflush(m_file);
+    }
+
+    FILE *m_file;
+    std::vector<CPUGovernorLog*> m_logs;
+    int m_instances;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_quit;
+  };
+
+  static const unsigned int kSize = 256;
+  CPUGovernorDecision m_decisions[kSize];
+  std::atomic<unsigned int> m_read, m_write;
+
+  int m_instance;
+};
+
+class CPUGovernor
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  CPUGovernor() :
+    m_enabled(true),
+    m_secondsPerSample(1.0 / 44100),
+    m_load(0.0),
+    m_tier(kQualityFull),
+    m_holdSteps(1),
+    m_holdBlocks(0),
+    m_overloadSteps(kMinOverloadBlocks),
+    m_overloadBlocks(0),
+    m_headroomBlocks(0),
+    m_block(0),
+    m_start(Clock::now())
+  {}
+
+  void SetEnabled(bool enable)
+  {
+    m_enabled = enable;
+    if (!enable) Change(kQualityFull);
+  }
+
+  // Deadline is block size / sample rate, so per sample it's just the
+  // sample period.
+  void SetDeadline(int blockSize, double sampleRate)
+  {
+    m_secondsPerSample = 1.0 / sampleRate;
+    m_holdSteps = (int)(kHoldTime * sampleRate / (blockSize > 0 ? blockSize : 1)) + 1;
+
+    m_overloadSteps = (int)(kOverloadTime * sampleRate / (blockSize > 0 ? blockSize : 1)) + 1;
+    if (m_overloadSteps < kMinOverloadBlocks) m_overloadSteps = kMinOverloadBlocks;
+  }
+
+  // Time spent before this (e.g. waiting for another thread) doesn't count
+  // as load.
+  void BeginBlock() { m_blockStart = Clock::now(); }
+
+  // Returns the quality tier to use from the next block on.
+  int EndBlock(int samples)
+  {
+    m_block++;
+    if (!m_enabled || samples <= 0) return m_tier;
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - m_blockStart).count();
+    double load = elapsed / (samples * m_secondsPerSample);
+
+    m_load += (load - m_load) * 0.05;
+
+    // Only step down when over budget for several blocks in a row, not on a
+    // single slow block (cold cache, delay line cleared, etc.)
+    m_overloadBlocks = load > kHighLoad ? m_overloadBlocks + 1 : 0;
+
+    if (m_holdBlocks > 0)
+    {
+      m_holdBlocks--;
+    }
+    else if (m_overloadBlocks >= m_overloadSteps && m_tier < kNumQualityTiers - 1)
+    {
+      Change(m_tier + 1);
+    }
+    else if (m_load < kLowLoad && m_tier > kQualityFull)
+    {
+      // Step back up only after a sustained period of headroom
+      if (++m_headroomBlocks >= 4 * m_holdSteps) Change(m_tier - 1);
+    }
+    else
+    {
+      m_headroomBlocks = 0;
+    }
+
+    return m_tier;
+  }
+
+  int Tier() const { return m_tier; }
+  double Load() const { return m_load; }
+
+private:
+  void Change(int tier)
+  {
+    if (tier == m_tier) return;
+
+    CPUGovernorDecision decision;
+    decision.time = std::chrono::duration<double>(Clock::now() - m_start).count();
+    decision.block = m_block;
+    decision.load = m_load;
+    decision.fromTier = m_tier;
+    decision.toTier = tier;
+    m_log.Push(decision);
+
+    // Give the new tier time to take effect before deciding again
+    m_tier = tier;
+    m_holdBlocks = m_holdSteps;
+    m_overloadBlocks = 0;
+    m_headroomBlocks = 0;
+  }
+
+  // Fraction of the deadline this plugin may use, leaving the rest to the
+  // host and other plugins.
+  static constexpr double kHighLoad = 0.5;
+  static constexpr double kLowLoad = 0.2;
+  static constexpr double kHoldTime = 0.25; // Seconds
+  static constexpr double kOverloadTime = 0.01; // Seconds
+  static const int kMinOverloadBlocks = 3;
+
+  bool m_enabled;
+  double m_secondsPerSample;
+  double m_load;
+
+  int m_tier;
+  int m_holdSteps;
+  int m_holdBlocks;
+  int m_overloadSteps;
+  int m_overloadBlocks;
+  int m_headroomBlocks;
+  unsigned int m_block;
+
+  Clock::time_point m_start, m_blockStart;
+
+  CPUGovernorLog m_log;
+};
@@ -0,0 +1,1107 @@
+#pragma once
+
+// Block-based DSP kernels, built in several instruction set variants in one
+// binary. The best variant supported by the CPU (except "avx512", see
+// Best()) is selected once at startup, but it can be forced by setting the
+// DRMIX_DSP_KERNELS environment variable to "generic", "sse2", "avx2",
+// "avx512", or "neon" (useful for testing and benchmarking), or per synth
+// instance by SawtoothSynth::SetKernels().
+//
+// The variants sound the same, but their output isn't sample-for-sample
+// interchangeable: the SIMD oscillators accumulate their phase per lane (see
+// sawtoothSSE2()), so it drifts away from the generic kernel's without bound.
+// Where output has to be reproducible (e.g. datasets, tests), always use the
+// same variant, e.g. "generic".
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+  #define DSP_X86
+  #include <emmintrin.h>
+
+  // ARM64EC emulates SSE only, so no AVX variants there.
+  #ifndef _M_ARM64EC
+    #define DSP_X86_AVX
+    #include <immintrin.h>
+  #endif
+
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #else
+    #include <cpuid.h>
+  #endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+  #define DSP_NEON
+  #include <arm_neon.h>
+#endif
+
+// GCC/Clang need a per-function target to emit AVX etc. without compiling the
+// whole file for it. MSVC always accepts the intrinsics, but won't use them
+// for plain C code, so there the non-intrinsic kernels are the same in every
+// variant.
+#if defined(__GNUC__) || defined(__clang__)
+  #define DSP_TARGET(isa) __attribute__((target(isa)))
+  #define DSP_INLINE inline __attribute__((always_inline))
+#else
+  #define DSP_TARGET(isa)
+  #define DSP_INLINE __forceinline
+#endif
+
+struct SawtoothState
+{
+  float phase;
+  float phaseIncrement;
+  bool antiAliasing;
+};
+
+struct EnvelopeState
+{
+  float attackTime; // Time for the amplitude to reach its peak
+  float decayTime; // Time for the amplitude to decay from peak to sustain level
+  float sustainLevel; // Level at which the amplitude sustains
+  float releaseTime; // Time for the amplitude to decay from sustain level to zero
+
+  float sampleRate;
+  float noteOnTime;
+};
+
+struct LowPassFilterState
+{
+  float cutoffFrequency;
+  float resonance;
+  float sampleRate;
+
+  // Cutoff frequency/resonance smoothing
+  float cutoffFrequencyTarget;
+  float resonanceTarget;
+  float smoothingFactor;
+
+  // Recalculate coefficients every controlRate samples while smoothing
+  int controlRate;
+  int controlCounter;
+
+  float x1, x2, y1, y2; // State variables
+  float b0, b1, b2, a1, a2; // Filter coefficients
+};
+
+enum EDSPKernels
+{
+  kDSPKernelsGeneric = 0,
+  kDSPKernelsSSE2,
+  kDSPKernelsAVX2,
+  kDSPKernelsAVX512,
+  kDSPKernelsNEON,
+
+  kNumDSPKernels
+};
+
+struct DSPKernels
+{
+  const char *name;
+
+  // Sawtooth wave between -1 and 1 with PolyBLEP anti-aliasing.
+  void (*sawtooth)(float *output, int samples, SawtoothState *state);
+
+  // ADSR envelope for samples start..start + samples - 1 since note on.
+  void (*envelope)(float *output, int samples, int start, const EnvelopeState *state);
+
+  // buffer *= envelope * gain, envelope may be NULL (i.e. all 1.0).
+  void (*amplify)(float *buffer, const float *envelope, float gain, int samples);
+
+  // Low-pass filter with per-sample cutoff frequency target.
+  void (*lowPass)(double *output, const float *input, const float *cutoff, int samples, LowPassFilterState *state);
+
+  // Copy output channel (e.g. mono to stereo).
+  void (*copy)(double *dest, const double *src, int samples);
+
+  // output += input * gain.
+  void (*mix)(float *output, const float *input, float gain, int samples);
+
+  // Read from delay line buffer (of size mask + 1, a power of 2) with linear
+  // interpolation, delay[i] (>= 1) samples before writePos + i.
+  void (*delayLine)(float *output, const float *buffer, int mask, int writePos, const float *delay, int samples);
+
+  static const DSPKernels *Get(int variant);
+  static const DSPKernels *Find(const char *name);
+
+  static bool IsSupported(int variant);
+  static const DSPKernels *Best();
+
+  // Best or forced (by environment variable), selected only once.
+  static const DSPKernels *Default();
+};
+
+// Scalar building blocks, shared by the kernels and the DSP classes.
+
+static inline float SawtoothPolyBLEP(float phase, float phaseIncrement)
+{
+  float polyBLEP;
+
+  if (phase < phaseIncrement) {
+    float x = phase / phaseIncrement - 1.0;
+    polyBLEP = -(x*x);
+  }
+  else if (phase > 1.0 - phaseIncrement) {
+    float x = (phase - 1.0) / phaseIncrement + 1.0;
+    polyBLEP = x*x;
+  }
+  else {
+    polyBLEP = 0.0;
+  }
+
+  return polyBLEP;
+}
+
+static inline float EnvelopeValue(float deltaTime, const EnvelopeState *state)
+{
+  if (deltaTime < state->attackTime)
+  {
+    // Attack phase
+    return deltaTime / state->attackTime;
+  }
+  else if (deltaTime < state->attackTime + state->decayTime)
+  {
+    // Decay phase
+    return 1.0 - (1.0 - state->sustainLevel) * (deltaTime - state->attackTime) / state->decayTime;
+  }
+  else
+  {
+    // Sustain or Release phase
+    return state->sustainLevel * exp(-(deltaTime - state->attackTime - state->decayTime) / state->releaseTime);
+  }
+}
+
+static DSP_INLINE void LowPassCalculateCoefficients(LowPassFilterState *state)
+{
+  // Calculate filter coefficients based on cutoff frequency and resonance
+  float omega = 2.0 * M_PI * state->cutoffFrequency / state->sampleRate;
+  omega = omega < 0.0 ? 0.0 : omega;
+  omega = omega > 0.98 * M_PI ? 0.98 * M_PI : omega;
+  float alpha = sin(omega) / (2.0 * state->resonance);
+  float cosw = cos(omega);
+  float a0inv = 1.0 / (1.0 + alpha);
+  state->b0 = (1.0 - cosw) / 2.0 * a0inv;
+  state->b1 = (1.0 - cosw) * a0inv;
+  state->b2 = (1.0 - cosw) / 2.0 * a0inv;
+  state->a1 = -2.0 * cosw * a0inv;
+  state->a2 = (1.0 - alpha) * a0inv;
+}
+
+// The filter is recursive, so it doesn't vectorize across samples, but the
+// instruction set variants still benefit from e.g. FMA.
+static DSP_INLINE void LowPassProcess(double *output, const float *input, const float *cutoff, int samples, LowPassFilterState *pState)
+{
+  LowPassFilterState state = *pState;
+
+  for (int i = 0; i < samples; i++)
+  {
+    state.cutoffFrequencyTarget = cutoff[i];
+
+    // Smooth cutoff frequency/resonance changes
+    if (state.cutoffFrequency != state.cutoffFrequencyTarget ||
+        state.resonance != state.resonanceTarget)
+    {
+      state.cutoffFrequency = (state.cutoffFrequencyTarget - state.cutoffFrequency) * state.smoothingFactor + state.cutoffFrequency;
+      state.resonance = (state.resonanceTarget - state.resonance) * state.smoothingFactor + state.resonance;
+
+      if (--state.controlCounter <= 0)
+      {
+        LowPassCalculateCoefficients(&state);
+        state.controlCounter = state.controlRate;
+      }
+    }
+
+    // Calculate output using Direct Form I structure
+    float y = state.b0 * input[i] + state.b1 * state.x1 + state.b2 * state.x2 - state.a1 * state.y1 - state.a2 * state.y2;
+
+    // Update state variables
+    state.x2 = state.x1;
+    state.x1 = input[i];
+    state.y2 = state.y1;
+    state.y1 = y;
+
+    output[i] = y;
+  }
+
+  *pState = state;
+}
+
+// Generic (plain C) kernels, these are also the reference implementation.
+
+static void sawtoothGeneric(float *output, int samples, SawtoothState *state)
+{
+  float phase = state->phase;
+  const float phaseIncrement = state->phaseIncrement;
+
+  if (state->antiAliasing)
+  {
+    for (int i = 0; i < samples; i++)
+    {
+      float sawtooth = 2.0 * phase - 1.0;
+      output[i] = sawtooth - SawtoothPolyBLEP(phase, phaseIncrement);
+      phase += phaseIncrement;
+      phase -= (int)phase;
+    }
+  }
+  else
+  {
+    for (int i = 0; i < samples; i++)
+    {
+      output[i] = 2.0 * phase - 1.0;
+      phase += phaseIncrement;
+      phase -= (int)phase;
+    }
+  }
+
+  state->phase = phase;
+}
+
+static void envelopeGeneric(float *output, int samples, int start, const EnvelopeState *state)
+{
+  for (int i = 0; i < samples; i++)
+  {
+    float time = (start + i) / state->sampleRate;
+    output[i] = EnvelopeValue(time - state->noteOnTime, state);
+  }
+}
+
+static void amplifyGeneric(float *buffer, const float *envelope, float gain, int samples)
+{
+  if (envelope)
+  {
+    for (int i = 0; i < samples; i++) buffer[i] = buffer[i] * envelope[i] * gain;
+  }
+  else
+  {
+    for (int i = 0; i < samples; i++) buffer[i] *= gain;
+  }
+}
+
+static void lowPassGeneric(double *output, const float *input, const float *cutoff, int samples, LowPassFilterState *state)
+{
+  LowPassProcess(output, input, cutoff, samples, state);
+}
+
+static void copyGeneric(double *dest, const double *src, int samples)
+{
+  memcpy(dest, src, samples * sizeof(double));
+}
+
+static void mixGeneric(float *output, const float *input, float gain, int samples)
+{
+  for (int i = 0; i < samples; i++) output[i] += input[i] * gain;
+}
+
+static void delayLineGeneric(float *output, const float *buffer, int mask, int writePos, const float *delay, int samples)
+{
+  for (int i = 0; i < samples; i++)
+  {
+    int n = (int)delay[i];
+    float frac = delay[i] - n;
+
+    int j = (writePos + i - n) & mask;
+    float a = buffer[j];
+    float b = buffer[(j - 1) & mask];
+    output[i] = a + (b - a) * frac;
+  }
+}
+
+#ifdef DSP_X86
+
+// SSE2 kernels
+
+// e^x, relative error < 2e-7 for -87 <= x <= 88.
+DSP_TARGET("sse2") static inline __m128 expSSE2(__m128 x)
+{
+  x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-87.0f)), _mm_set1_ps(88.0f));
+
+  // e^x = 2^i * 2^f, with i = round(x/ln(2)), -0.5 <= f <= 0.5
+  __m128 t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f));
+  __m128i i = _mm_cvtps_epi32(t);
+  __m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(i));
+
+  __m128 p = _mm_set1_ps(1.54035304e-4f);
+  p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.33335581e-3f));
+  p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.61812911e-3f));
+  p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.55041087e-2f));
+  p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.40226507e-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.93147181e-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+
+  __m128i e = _mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23);
+  return _mm_mul_ps(p, _mm_castsi128_ps(e));
+}
+
+DSP_TARGET("sse2") static void sawtoothSSE2(float *output, int samples, SawtoothState *state)
+{
+  const bool antiAliasing = state->antiAliasing;
+  float phase = state->phase;
+  const float phaseIncrement = state->phaseIncrement;
+
+  int i = 0;
+  if (samples >= 4)
+  {
+    // Start each lane at one of the next 4 phases, then advance each
+    // lane by 4 phase increments. This rounds differently than adding 1
+    // increment per sample (as the generic kernel does), so the phase
+    // slowly drifts apart (e.g. 0.005 cycles after 10 s at 110 Hz), but it
+    // is actually closer to the exact phase. Following the generic kernel
+    // would need a serial loop, which is as slow as the generic kernel.
+    float start[4];
+    for (int j = 0; j < 4; j++)
+    {
+      start[j] = phase;
+      phase += phaseIncrement;
+      phase -= (int)phase;
+    }
+
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 inc = _mm_set1_ps(phaseIncrement);
+    const __m128 inc4 = _mm_set1_ps(4.0f * phaseIncrement);
+    const __m128 incInv = _mm_set1_ps(1.0f / phaseIncrement);
+    const __m128 upper = _mm_sub_ps(one, inc);
+
+    __m128 p = _mm_loadu_ps(start);
+    for (; i <= samples - 4; i += 4)
+    {
+      __m128 sawtooth = _mm_sub_ps(_mm_add_ps(p, p), one);
+
+      // PolyBLEP
+      if (antiAliasing)
+      {
+        __m128 lo = _mm_cmplt_ps(p, inc);
+        __m128 hi = _mm_andnot_ps(lo, _mm_cmpgt_ps(p, upper));
+        __m128 xlo = _mm_sub_ps(_mm_mul_ps(p, incInv), one);
+        __m128 xhi = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(p, one), incInv), one);
+        __m128 polyBLEP = _mm_or_ps(
+          _mm_and_ps(hi, _mm_mul_ps(xhi, xhi)),
+          _mm_and_ps(lo, _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(xlo, xlo))));
+
+        sawtooth = _mm_sub_ps(sawtooth, polyBLEP);
+      }
+
+      _mm_storeu_ps(&output[i], sawtooth);
+
+      p = _mm_add_ps(p, inc4);
+      p = _mm_sub_ps(p, _mm_cvtepi32_ps(_mm_cvttps_epi32(p)));
+    }
+
+    phase = _mm_cvtss_f32(p);
+  }
+
+  state->phase = phase;
+  sawtoothGeneric(&output[i], samples - i, state);
+}
+
+DSP_TARGET("sse2") static void envelopeSSE2(float *output, int samples, int start, const EnvelopeState *state)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 attack = _mm_set1_ps(state->attackTime);
+  const __m128 attackInv = _mm_set1_ps(1.0f / state->attackTime);
+  const __m128 decay = _mm_set1_ps(state->decayTime);
+  const __m128 decayEnd = _mm_set1_ps(state->attackTime + state->decayTime);
+  const __m128 decaySlope = _mm_set1_ps((1.0f - state->sustainLevel) / state->decayTime);
+  const __m128 sustain = _mm_set1_ps(state->sustainLevel);
+  const __m128 release = _mm_set1_ps(-state->releaseTime);
+  const __m128 sampleRate = _mm_set1_ps(state->sampleRate);
+  const __m128 noteOnTime = _mm_set1_ps(state->noteOnTime);
+
+  int i = 0;
+  for (; i <= samples - 4; i += 4)
+  {
+    __m128 n = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(start + i), _mm_set_epi32(3, 2, 1, 0)));
+
+    // Divide and subtract in the same order as the generic kernel, as the
+    // envelope can be steep (e.g. a short release)
+    __m128 deltaTime = _mm_sub_ps(_mm_div_ps(n, sampleRate), noteOnTime);
+
+    __m128 a = _mm_mul_ps(deltaTime, attackInv);
+    __m128 d = _mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(deltaTime, attack), decaySlope));
+    __m128 r = _mm_mul_ps(sustain, expSSE2(_mm_div_ps(_mm_sub_ps(_mm_sub_ps(deltaTime, attack), decay), release)));
+
+    __m128 isAttack = _mm_cmplt_ps(deltaTime, attack);
+    __m128 isDecay = _mm_cmplt_ps(deltaTime, decayEnd);
+    __m128 ad = _mm_or_ps(_mm_and_ps(isAttack, a), _mm_andnot_ps(isAttack, d));
+    _mm_storeu_ps(&output[i], _mm_or_ps(_mm_and_ps(isDecay, ad), _mm_andnot_ps(isDecay, r)));
+  }
+
+  envelopeGeneric(&output[i], samples - i, start + i, state);
+}
+
+DSP_TARGET("sse2") static void amplifySSE2(float *buffer, const float *envelope, float gain, int samples)
+{
+  const __m128 g = _mm_set1_ps(gain);
+
+  int i = 0;
+  if (envelope)
+  {
+    for (; i <= samples - 4; i += 4)
+    {
+      __m128 x = _mm_mul_ps(_mm_loadu_ps(&buffer[i]), _mm_loadu_ps(&envelope[i]));
+      _mm_storeu_ps(&buffer[i], _mm_mul_ps(x, g));
+    }
+    envelope += i;
+  }
+  else
+  {
+    for (; i <= samples - 4; i += 4)
+    {
+      _mm_storeu_ps(&buffer[i], _mm_mul_ps(_mm_loadu_ps(&buffer[i]), g));
+    }
+  }
+
+  amplifyGeneric(&buffer[i], envelope, gain, samples - i);
+}
+
+DSP_TARGET("sse2") static void copySSE2(double *dest, const double *src, int samples)
+{
+  int i = 0;
+  for (; i <= samples - 4; i += 4)
+  {
+    __m128d a = _mm_loadu_pd(&src[i]);
+    __m128d b = _mm_loadu_pd(&src[i + 2]);
+    _mm_storeu_pd(&dest[i], a);
+    _mm_storeu_pd(&dest[i + 2], b);
+  }
+
+  for (; i < samples; i++) dest[i] = src[i];
+}
+
+DSP_TARGET("sse2") static void mixSSE2(float *output, const float *input, float gain, int samples)
+{
+  const __m128 g = _mm_set1_ps(gain);
+
+  int i = 0;
+  for (; i <= samples - 4; i += 4)
+  {
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(&input[i]), g);
+    _mm_storeu_ps(&output[i], _mm_add_ps(_mm_loadu_ps(&output[i]), x));
+  }
+
+  mixGeneric(&output[i], &input[i], gain, samples - i);
+}
+
+DSP_TARGET("sse2") static void delayLineSSE2(float *output, const float *buffer, int mask, int writePos, const float *delay, int samples)
+{
+  const __m128i m = _mm_set1_epi32(mask);
+  const __m128i one = _mm_set1_epi32(1);
+
+  int i = 0;
+  for (; i <= samples - 4; i += 4)
+  {
+    __m128 d = _mm_loadu_ps(&delay[i]);
+    __m128i n = _mm_cvttps_epi32(d);
+    __m128 frac = _mm_sub_ps(d, _mm_cvtepi32_ps(n));
+
+    __m128i pos = _mm_add_epi32(_mm_set1_epi32(writePos + i), _mm_set_epi32(3, 2, 1, 0));
+    __m128i j = _mm_and_si128(_mm_sub_epi32(pos, n), m);
+    __m128i k = _mm_and_si128(_mm_sub_epi32(j, one), m);
+
+    // No gather in SSE2, so load the taps one by one.
+    int jj[4], kk[4];
+    _mm_storeu_si128((__m128i*)jj, j);
+    _mm_storeu_si128((__m128i*)kk, k);
+
+    __m128 a = _mm_set_ps(buffer[jj[3]], buffer[jj[2]], buffer[jj[1]], buffer[jj[0]]);
+    __m128 b = _mm_set_ps(buffer[kk[3]], buffer[kk[2]], buffer[kk[1]], buffer[kk[0]]);
+    _mm_storeu_ps(&output[i], _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), frac)));
+  }
+
+  delayLineGeneric(&output[i], buffer, mask, writePos + i, &delay[i], samples - i);
+}
+
+#endif // DSP_X86
+
+#ifdef DSP_X86_AVX
+
+// AVX2 (+FMA) kernels
+
+DSP_TARGET("avx2,fma") static inline __m256 expAVX2(__m256 x)
+{
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(88.0f));
+
+  __m256 t = _mm256_mul_ps(x, _mm256_set1_ps(1.44269504f));
+  __m256 r = _mm256_round_ps(t, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 f = _mm256_sub_ps(t, r);
+
+  __m256 p = _mm256_set1_ps(1.54035304e-4f);
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.33335581e-3f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(9.61812911e-3f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(5.55041087e-2f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(2.40226507e-1f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(6.93147181e-1f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.0f));
+
+  __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(r), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+DSP_TARGET("avx2,fma") static void sawtoothAVX2(float *output, int samples, SawtoothState *state)
+{
+  const bool antiAliasing = state->antiAliasing;
+  float phase = state->phase;
+  const float phaseIncrement = state->phaseIncrement;
+
+  int i = 0;
+  if (samples >= 8)
+  {
+    float start[8];
+    for (int j = 0; j < 8; j++)
+    {
+      start[j] = phase;
+      phase += phaseIncrement;
+      phase -= (int)phase;
+    }
+
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 inc = _mm256_set1_ps(phaseIncrement);
+    const __m256 inc8 = _mm256_set1_ps(8.0f * phaseIncrement);
+    const __m256 incInv = _mm256_set1_ps(1.0f / phaseIncrement);
+    const __m256 upper = _mm256_sub_ps(one, inc);
+
+    __m256 p = _mm256_loadu_ps(start);
+    for (; i <= samples - 8; i += 8)
+    {
+      __m256 sawtooth = _mm256_sub_ps(_mm256_add_ps(p, p), one);
+
+      if (antiAliasing)
+      {
+        __m256 lo = _mm256_cmp_ps(p, inc, _CMP_LT_OQ);
+        __m256 hi = _mm256_andnot_ps(lo, _mm256_cmp_ps(p, upper, _CMP_GT_OQ));
+        __m256 xlo = _mm256_fmsub_ps(p, incInv, one);
+        __m256 xhi = _mm256_fmadd_ps(_mm256_sub_ps(p, one), incInv, one);
+        __m256 polyBLEP = _mm256_blendv_ps(_mm256_setzero_ps(), _mm256_mul_ps(xhi, xhi), hi);
+        polyBLEP = _mm256_blendv_ps(polyBLEP, _mm256_fnmadd_ps(xlo, xlo, _mm256_setzero_ps()), lo);
+
+        sawtooth = _mm256_sub_ps(sawtooth, polyBLEP);
+      }
+
+      _mm256_storeu_ps(&output[i], sawtooth);
+
+      p = _mm256_add_ps(p, inc8);
+      p = _mm256_sub_ps(p, _mm256_round_ps(p, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC));
+    }
+
+    phase = _mm_cvtss_f32(_mm256_castps256_ps128(p));
+  }
+
+  state->phase = phase;
+  sawtoothGeneric(&output[i], samples - i, state);
+}
+
+DSP_TARGET("avx2,fma") static void envelopeAVX2(float *output, int samples, int start, const EnvelopeState *state)
+{
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 attack = _mm256_set1_ps(state->attackTime);
+  const __m256 attackInv = _mm256_set1_ps(1.0f / state->attackTime);
+  const __m256 decay = _mm256_set1_ps(state->decayTime);
+  const __m256 decayEnd = _mm256_set1_ps(state->attackTime + state->decayTime);
+  const __m256 decaySlope = _mm256_set1_ps((1.0f - state->sustainLevel) / state->decayTime);
+  const __m256 sustain = _mm256_set1_ps(state->sustainLevel);
+  const __m256 release = _mm256_set1_ps(-state->releaseTime);
+  const __m256 sampleRate = _mm256_set1_ps(state->sampleRate);
+  const __m256 noteOnTime = _mm256_set1_ps(state->noteOnTime);
+
+  int i = 0;
+  for (; i <= samples - 8; i += 8)
+  {
+    __m256 n = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(start + i), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0)));
+    __m256 deltaTime = _mm256_sub_ps(_mm256_div_ps(n, sampleRate), noteOnTime);
+
+    __m256 a = _mm256_mul_ps(deltaTime, attackInv);
+    __m256 d = _mm256_fnmadd_ps(_mm256_sub_ps(deltaTime, attack), decaySlope, one);
+    __m256 r = _mm256_mul_ps(sustain, expAVX2(_mm256_div_ps(_mm256_sub_ps(_mm256_sub_ps(deltaTime, attack), decay), release)));
+
+    __m256 isAttack = _mm256_cmp_ps(deltaTime, attack, _CMP_LT_OQ);
+    __m256 isDecay = _mm256_cmp_ps(deltaTime, decayEnd, _CMP_LT_OQ);
+    _mm256_storeu_ps(&output[i], _mm256_blendv_ps(r, _mm256_blendv_ps(d, a, isAttack), isDecay));
+  }
+
+  envelopeGeneric(&output[i], samples - i, start + i, state);
+}
+
+DSP_TARGET("avx2,fma") static void amplifyAVX2(float *buffer, const float *envelope, float gain, int samples)
+{
+  const __m256 g = _mm256_set1_ps(gain);
+
+  int i = 0;
+  if (envelope)
+  {
+    for (; i <= samples - 8; i += 8)
+    {
+      __m256 x = _mm256_mul_ps(_mm256_loadu_ps(&buffer[i]), _mm256_loadu_ps(&envelope[i]));
+      _mm256_storeu_ps(&buffer[i], _mm256_mul_ps(x, g));
+    }
+    envelope += i;
+  }
+  else
+  {
+    for (; i <= samples - 8; i += 8)
+    {
+      _mm256_storeu_ps(&buffer[i], _mm256_mul_ps(_mm256_loadu_ps(&buffer[i]), g));
+    }
+  }
+
+  amplifyGeneric(&buffer[i], envelope, gain, samples - i);
+}
+
+DSP_TARGET("avx2,fma") static void lowPassAVX2(double *output, const float *input, const float *cutoff, int samples, LowPassFilterState *state)
+{
+  LowPassProcess(output, input, cutoff, samples, state);
+}
+
+DSP_TARGET("avx2,fma") static void copyAVX2(double *dest, const double *src, int samples)
+{
+  int i = 0;
+  for (; i <= samples - 8; i += 8)
+  {
+    __m256d a = _mm256_loadu_pd(&src[i]);
+    __m256d b = _mm256_loadu_pd(&src[i + 4]);
+    _mm256_storeu_pd(&dest[i], a);
+    _mm256_storeu_pd(&dest[i + 4], b);
+  }
+
+  for (; i < samples; i++) dest[i] = src[i];
+}
+
+DSP_TARGET("avx2,fma") static void mixAVX2(float *output, const float *input, float gain, int samples)
+{
+  const __m256 g = _mm256_set1_ps(gain);
+
+  int i = 0;
+  for (; i <= samples - 8; i += 8)
+  {
+    _mm256_storeu_ps(&output[i], _mm256_fmadd_ps(_mm256_loadu_ps(&input[i]), g, _mm256_loadu_ps(&output[i])));
+  }
+
+  mixGeneric(&output[i], &input[i], gain, samples - i);
+}
+
+DSP_TARGET("avx2,fma") static void delayLineAVX2(float *output, const float *buffer, int mask, int writePos, const float *delay, int samples)
+{
+  const __m256i m = _mm256_set1_epi32(mask);
+  const __m256i one = _mm256_set1_epi32(1);
+
+  int i = 0;
+  for (; i <= samples - 8; i += 8)
+  {
+    __m256 d = _mm256_loadu_ps(&delay[i]);
+    __m256i n = _mm256_cvttps_epi32(d);
+    __m256 frac = _mm256_sub_ps(d, _mm256_cvtepi32_ps(n));
+
+    __m256i pos = _mm256_add_epi32(_mm256_set1_epi32(writePos + i), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    __m256i j = _mm256_and_si256(_mm256_sub_epi32(pos, n), m);
+    __m256i k = _mm256_and_si256(_mm256_sub_epi32(j, one), m);
+
+    __m256 a = _mm256_i32gather_ps(buffer, j, 4);
+    __m256 b = _mm256_i32gather_ps(buffer, k, 4);
+    _mm256_storeu_ps(&output[i], _mm256_fmadd_ps(_mm256_sub_ps(b, a), frac, a));
+  }
+
+  delayLineGeneric(&output[i], buffer, mask, writePos + i, &delay[i], samples - i);
+}
+
+// AVX-512 kernels, the others reuse the AVX2 kernels.
+
+DSP_TARGET("avx512f") static void amplifyAVX512(float *buffer, const float *envelope, float gain, int samples)
+{
+  const __m512 g = _mm512_set1_ps(gain);
+
+  int i = 0;
+  if (envelope)
+  {
+    for (; i <= samples - 16; i += 16)
+    {
+      __m512 x = _mm512_mul_ps(_mm512_loadu_ps(&buffer[i]), _mm512_loadu_ps(&envelope[i]));
+      _mm512_storeu_ps(&buffer[i], _mm512_mul_ps(x, g));
+    }
+    envelope += i;
+  }
+  else
+  {
+    for (; i <= samples - 16; i += 16)
+    {
+      _mm512_storeu_ps(&buffer[i], _mm512_mul_ps(_mm512_loadu_ps(&buffer[i]), g));
+    }
+  }
+
+  amplifyGeneric(&buffer[i], envelope, gain, samples - i);
+}
+
+DSP_TARGET("avx512f") static void lowPassAVX512(double *output, const float *input, const float *cutoff, int samples, LowPassFilterState *state)
+{
+  LowPassProcess(output, input, cutoff, samples, state);
+}
+
+DSP_TARGET("avx512f") static void copyAVX512(double *dest, const double *src, int samples)
+{
+  int i = 0;
+  for (; i <= samples - 8; i += 8)
+  {
+    _mm512_storeu_pd(&dest[i], _mm512_loadu_pd(&src[i]));
+  }
+
+  for (; i < samples; i++) dest[i] = src[i];
+}
+
+#endif // DSP_X86_AVX
+
+#ifdef DSP_NEON
+
+// NEON kernels
+
+static inline float32x4_t expNEON(float32x4_t x)
+{
+  x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(-87.0f)), vdupq_n_f32(88.0f));
+
+  float32x4_t t = vmulq_n_f32(x, 1.44269504f);
+  int32x4_t i = vcvtnq_s32_f32(t);
+  float32x4_t f = vsubq_f32(t, vcvtq_f32_s32(i));
+
+  float32x4_t p = vdupq_n_f32(1.54035304e-4f);
+  p = vfmaq_f32(vdupq_n_f32(1.33335581e-3f), p, f);
+  p = vfmaq_f32(vdupq_n_f32(9.61812911e-3f), p, f);
+  p = vfmaq_f32(vdupq_n_f32(5.55041087e-2f), p, f);
+  p = vfmaq_f32(vdupq_n_f32(2.40226507e-1f), p, f);
+  p = vfmaq_f32(vdupq_n_f32(6.93147181e-1f), p, f);
+  p = vfmaq_f32(vdupq_n_f32(1.0f), p, f);
+
+  int32x4_t e = vshlq_n_s32(vaddq_s32(i, vdupq_n_s32(127)), 23);
+  return vmulq_f32(p, vreinterpretq_f32_s32(e));
+}
+
+static void sawtoothNEON(float *output, int samples, SawtoothState *state)
+{
+  const bool antiAliasing = state->antiAliasing;
+  float phase = state->phase;
+  const float phaseIncrement = state->phaseIncrement;
+
+  int i = 0;
+  if (samples >= 4)
+  {
+    float start[4];
+    for (int j = 0; j < 4; j++)
+    {
+      start[j] = phase;
+      phase += phaseIncrement;
+      phase -= (int)phase;
+    }
+
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t inc = vdupq_n_f32(phaseIncrement);
+    const float32x4_t inc4 = vdupq_n_f32(4.0f * phaseIncrement);
+    const float32x4_t incInv = vdupq_n_f32(1.0f / phaseIncrement);
+    const float32x4_t upper = vsubq_f32(one, inc);
+
+    float32x4_t p = vld1q_f32(start);
+    for (; i <= samples - 4; i += 4)
+    {
+      float32x4_t sawtooth = vsubq_f32(vaddq_f32(p, p), one);
+
+      if (antiAliasing)
+      {
+        uint32x4_t lo = vcltq_f32(p, inc);
+        uint32x4_t hi = vcgtq_f32(p, upper);
+        float32x4_t xlo = vfmaq_f32(vnegq_f32(one), p, incInv);
+        float32x4_t xhi = vfmaq_f32(one, vsubq_f32(p, one), incInv);
+        float32x4_t polyBLEP = vbslq_f32(hi, vmulq_f32(xhi, xhi), zero);
+        polyBLEP = vbslq_f32(lo, vnegq_f32(vmulq_f32(xlo, xlo)), polyBLEP);
+
+        sawtooth = vsubq_f32(sawtooth, polyBLEP);
+      }
+
+      vst1q_f32(&output[i], sawtooth);
+
+      p = vaddq_f32(p, inc4);
+      p = vsubq_f32(p, vrndq_f32(p));
+    }
+
+    phase = vgetq_lane_f32(p, 0);
+  }
+
+  state->phase = phase;
+  sawtoothGeneric(&output[i], samples - i, state);
+}
+
+static void envelopeNEON(float *output, int samples, int start, const EnvelopeState *state)
+{
+  static const int32_t lanes[4] = { 0, 1, 2, 3 };
+
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  const float32x4_t attack = vdupq_n_f32(state->attackTime);
+  const float32x4_t attackInv = vdupq_n_f32(1.0f / state->attackTime);
+  const float32x4_t decay = vdupq_n_f32(state->decayTime);
+  const float32x4_t decayEnd = vdupq_n_f32(state->attackTime + state->decayTime);
+  const float32x4_t decaySlope = vdupq_n_f32((1.0f - state->sustainLevel) / state->decayTime);
+  const float32x4_t sustain = vdupq_n_f32(state->sustainLevel);
+  const float32x4_t release = vdupq_n_f32(-state->releaseTime);
+  const float32x4_t sampleRate = vdupq_n_f32(state->sampleRate);
+  const float32x4_t noteOnTime = vdupq_n_f32(state->noteOnTime);
+
+  int i = 0;
+  for (; i <= samples - 4; i += 4)
+  {
+    float32x4_t n = vcvtq_f32_s32(vaddq_s32(vdupq_n_s32(start + i), vld1q_s32(lanes)));
+    float32x4_t deltaTime = vsubq_f32(vdivq_f32(n, sampleRate), noteOnTime);
+
+    float32x4_t a = vmulq_f32(deltaTime, attackInv);
+    float32x4_t d = vfmsq_f32(one, vsubq_f32(deltaTime, attack), decaySlope);
+    float32x4_t r = vmulq_f32(sustain, expNEON(vdivq_f32(vsubq_f32(vsubq_f32(deltaTime, attack), decay), release)));
+
+    uint32x4_t isAttack = vcltq_f32(deltaTime, attack);
+    uint32x4_t isDecay = vcltq_f32(deltaTime, decayEnd);
+    vst1q_f32(&output[i], vbslq_f32(isDecay, vbslq_f32(isAttack, a, d), r));
+  }
+
+  envelopeGeneric(&output[i], samples - i, start + i, state);
+}
+
+static void amplifyNEON(float *buffer, const float *envelope, float gain, int samples)
+{
+  int i = 0;
+  if (envelope)
+  {
+    for (; i <= samples - 4; i += 4)
+    {
+      float32x4_t x = vmulq_f32(vld1q_f32(&buffer[i]), vld1q_f32(&envelope[i]));
+      vst1q_f32(&buffer[i], vmulq_n_f32(x, gain));
+    }
+    envelope += i;
+  }
+  else
+  {
+    for (; i <= samples - 4; i += 4)
+    {
+      vst1q_f32(&buffer[i], vmulq_n_f32(vld1q_f32(&buffer[i]), gain));
+    }
+  }
+
+  amplifyGeneric(&buffer[i], envelope, gain, samples - i);
+}
+
+static void copyNEON(double *dest, const double *src, int samples)
+{
+  int i = 0;
+  for (; i <= samples - 4; i += 4)
+  {
+    float64x2_t a = vld1q_f64(&src[i]);
+    float64x2_t b = vld1q_f64(&src[i + 2]);
+    vst1q_f64(&dest[i], a);
+    vst1q_f64(&dest[i + 2], b);
+  }
+
+  for (; i < samples; i++) dest[i] = src[i];
+}
+
+static void mixNEON(float *output, const float *input, float gain, int samples)
+{
+  int i = 0;
+  for (; i <= samples - 4; i += 4)
+  {
+    vst1q_f32(&output[i], vmlaq_n_f32(vld1q_f32(&output[i]), vld1q_f32(&input[i]), gain));
+  }
+
+  mixGeneric(&output[i], &input[i], gain, samples - i);
+}
+
+static void delayLineNEON(float *output, const float *buffer, int mask, int writePos, const float *delay, int samples)
+{
+  static const int32_t lanes[4] = { 0, 1, 2, 3 };
+
+  const int32x4_t m = vdupq_n_s32(mask);
+  const int32x4_t one = vdupq_n_s32(1);
+
+  int i = 0;
+  for (; i <= samples - 4; i += 4)
+  {
+    float32x4_t d = vld1q_f32(&delay[i]);
+    int32x4_t n = vcvtq_s32_f32(d);
+    float32x4_t frac = vsubq_f32(d, vcvtq_f32_s32(n));
+
+    int32x4_t pos = vaddq_s32(vdupq_n_s32(writePos + i), vld1q_s32(lanes));
+    int32x4_t j = vandq_s32(vsubq_s32(pos, n), m);
+    int32x4_t k = vandq_s32(vsubq_s32(j, one), m);
+
+    // No gather in NEON, so load the taps one by one.
+    int32_t jj[4], kk[4];
+    vst1q_s32(jj, j);
+    vst1q_s32(kk, k);
+
+    float aa[4] = { buffer[jj[0]], buffer[jj[1]], buffer[jj[2]], buffer[jj[3]] };
+    float bb[4] = { buffer[kk[0]], buffer[kk[1]], buffer[kk[2]], buffer[kk[3]] };
+    float32x4_t a = vld1q_f32(aa);
+    float32x4_t b = vld1q_f32(bb);
+    vst1q_f32(&output[i], vfmaq_f32(a, vsubq_f32(b, a), frac));
+  }
+
+  delayLineGeneric(&output[i], buffer, mask, writePos + i, &delay[i], samples - i);
+}
+
+#endif // DSP_NEON
+
+// Runtime dispatch
+
+#ifdef DSP_X86
+
+static void DSPCPUID(int leaf, int subleaf, unsigned int regs[4])
+{
+  #ifdef _MSC_VER
+  int r[4];
+  __cpuidex(r, leaf, subleaf);
+  for (int i = 0; i < 4; i++) regs[i] = r[i];
+  #else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+  #endif
+}
+
+// OS support for saving/restoring extended registers (XCR0).
+static unsigned long long DSPXGETBV()
+{
+  #ifdef _MSC_VER
+  return _xgetbv(0);
+  #else
+  unsigned int eax, edx;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((unsigned long long)edx << 32) | eax;
+  #endif
+}
+
+#endif // DSP_X86
+
+inline bool DSPKernels::IsSupported(int variant)
+{
+  switch (variant)
+  {
+    case kDSPKernelsGeneric: return true;
+
+    #ifdef DSP_X86
+    case kDSPKernelsSSE2:
+    {
+      #if defined(_M_X64) || defined(__x86_64__)
+      return true;
+      #else
+      unsigned int regs[4];
+      DSPCPUID(1, 0, regs);
+      return (regs[3] & (1 << 26)) != 0;
+      #endif
+    }
+    #endif
+
+    #ifdef DSP_X86_AVX
+    case kDSPKernelsAVX2:
+    case kDSPKernelsAVX512:
+    {
+      unsigned int regs[4];
+      DSPCPUID(0, 0, regs);
+      if (regs[0] < 7) return false;
+
+      // OSXSAVE, AVX, FMA
+      const unsigned int avxFma = (1 << 27) | (1 << 28) | (1 << 12);
+      DSPCPUID(1, 0, regs);
+      if ((regs[2] & avxFma) != avxFma) return false;
+
+      // XMM/YMM (and opmask/ZMM) state
+      const unsigned long long xcr0 = DSPXGETBV();
+      const unsigned long long xcr0Mask = variant == kDSPKernelsAVX512 ? 0xE6 : 0x06;
+      if ((xcr0 & xcr0Mask) != xcr0Mask) return false;
+
+      // AVX2 (and AVX-512F)
+      const unsigned int avx2 = variant == kDSPKernelsAVX512 ? (1 << 5) | (1 << 16) : 1 << 5;
+      DSPCPUID(7, 0, regs);
+      return (regs[1] & avx2) == avx2;
+    }
+    #endif
+
+    #ifdef DSP_NEON
+    // NEON is mandatory on ARM64.
+    case kDSPKernelsNEON: return true;
+    #endif
+  }
+
+  return false;
+}
+
+inline const DSPKernels *DSPKernels::Get(int variant)
+{
+  static const DSPKernels generic = { "generic", sawtoothGeneric, envelopeGeneric, amplifyGeneric, lowPassGeneric, copyGeneric, mixGeneric, delayLineGeneric };
+
+  #ifdef DSP_X86
+  static const DSPKernels sse2 = { "sse2", sawtoothSSE2, envelopeSSE2, amplifySSE2, lowPassGeneric, copySSE2, mixSSE2, delayLineSSE2 };
+  #endif
+
+  #ifdef DSP_X86_AVX
+  static const DSPKernels avx2 = { "avx2", sawtoothAVX2, envelopeAVX2, amplifyAVX2, lowPassAVX2, copyAVX2, mixAVX2, delayLineAVX2 };
+  static const DSPKernels avx512 = { "avx512", sawtoothAVX2, envelopeAVX2, amplifyAVX512, lowPassAVX512, copyAVX512, mixAVX2, delayLineAVX2 };
+  #endif
+
+  #ifdef DSP_NEON
+  static const DSPKernels neon = { "neon", sawtoothNEON, envelopeNEON, amplifyNEON, lowPassGeneric, copyNEON, mixNEON, delayLineNEON };
+  #endif
+
+  if (!IsSupported(variant)) return NULL;
+
+  switch (variant)
+  {
+    case kDSPKernelsGeneric: return &generic;
+
+    #ifdef DSP_X86
+    case kDSPKernelsSSE2: return &sse2;
+    #endif
+
+    #ifdef DSP_X86_AVX
+    case kDSPKernelsAVX2: return &avx2;
+    case kDSPKernelsAVX512: return &avx512;
+    #endif
+
+    #ifdef DSP_NEON
+    case kDSPKernelsNEON: return &neon;
+    #endif
+  }
+
+  return NULL;
+}
+
+inline const DSPKernels *DSPKernels::Find(const char *name)
+{
+  for (int i = 0; i < kNumDSPKernels; i++)
+  {
+    const DSPKernels *pKernels = Get(i);
+    if (pKernels && !strcmp(pKernels->name, name)) return pKernels;
+  }
+
+  return NULL;
+}
+
+inline const DSPKernels *DSPKernels::Best()
+{
+  for (int i = kNumDSPKernels - 1; i > kDSPKernelsGeneric; i--)
+  {
+    // Only amplify and copy are 512-bit, which gains little on 64 sample
+    // chunks, but may cost clock speed, so only when forced
+    if (i == kDSPKernelsAVX512) continue;
+
+    const DSPKernels *pKernels = Get(i);
+    if (pKernels) return pKernels;
+  }
+
+  return Get(kDSPKernelsGeneric);
+}
+
+inline const DSPKernels *DSPKernels::Default()
+{
+  struct Select
+  {
+    static const DSPKernels *Kernels()
+    {
+      const char *name = getenv("DRMIX_DSP_KERNELS");
+      const DSPKernels *pKernels = name ? Find(name) : NULL;
+      return pKernels ? pKernels : Best();
+    }
+  };
+
+  static const DSPKernels *const pKernels = Select::Kernels();
+  return pKernels;
+}
@@ -0,0 +1,302 @@
+// Test of the DSP kernels: runs every variant the CPU supports once from the
+// same (random) state as the generic kernel, for block sizes with every tail
+// length the SIMD loops leave (0..67 samples past whole vectors), and fails
+// unless the output matches the generic kernel's:
+//
+// - copy, amplify: exactly,
+// - mix, delayLine: within FMA rounding,
+// - lowPass: within FMA rounding (accumulated over the block),
+// - envelope: within 1e-6 (the SIMD exp() approximation),
+// - sawtooth: within 4e-6 cycles (the per lane phase, see sawtoothSSE2()).
+//
+// Usage: DSPKernelsTest [trials]
+//
+// Build and run: nmake test (Windows), or
+// c++ -O2 -std=c++11 -I . DSPKernelsTest.cpp -o DSPKernelsTest && ./DSPKernelsTest
+
+#include "DSPKernels.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int kMaxSamples = 64 + 67;
+static const int kDelaySize = 1024; // Power of 2
+
+// Tolerances
+static const float kFMATolerance = 2.5e-7f; // About 2 ulps at 1.0
+static const double kLowPassTolerance = 1e-5;
+static const float kEnvelopeTolerance = 1e-6f;
+static const float kPhaseTolerance = 4e-6f; // Cycles, rounding over kMaxSamples
+
+// Deterministic, so every run tests the same states.
+class TestRandom
+{
+public:
+  TestRandom(uint32_t seed) : m_state(seed) {}
+
+  // 0..1
+  float Next()
+  {
+    m_state = m_state * 1664525u + 1013904223u;
+    return (float)(m_state >> 8) / (float)(1 << 24);
+  }
+
+  float Next(float min, float max) { return min + (max - min) * Next(); }
+
+private:
+  uint32_t m_state;
+};
+
+class KernelTest
+{
+public:
+  KernelTest(const DSPKernels *pKernels) : m_kernels(pKernels), m_generic(DSPKernels::Get(kDSPKernelsGeneric)), m_failed(0) {}
+
+  // Fills the buffers with random data, and tests all kernels for the given
+  // number of samples.
+  void Run(TestRandom *pRnd, int samples)
+  {
+    for (int i = 0; i < kMaxSamples; i++)
+    {
+      m_input[i] = pRnd->Next(-1.0f, 1.0f);
+      m_input2[i] = pRnd->Next(-1.0f, 1.0f);
+      m_envelope[i] = pRnd->Next();
+      m_cutoff[i] = pRnd->Next(20.0f, 20000.0f);
+      m_delay[i] = pRnd->Next(1.0f, kDelaySize - 1.0f);
+      m_doubleInput[i] = pRnd->Next(-1.0f, 1.0f);
+    }
+
+    for (int i = 0; i < kDelaySize; i++) m_delayBuffer[i] = pRnd->Next(-1.0f, 1.0f);
+
+    TestCopy(samples);
+    TestAmplify(pRnd, samples);
+    TestMix(pRnd, samples);
+    TestDelayLine(pRnd, samples);
+    TestLowPass(pRnd, samples);
+    TestEnvelope(pRnd, samples);
+    TestSawtooth(pRnd, samples);
+  }
+
+  int Failed() const { return m_failed; }
+
+private:
+  void TestCopy(int samples)
+  {
+    double a[kMaxSamples], b[kMaxSamples];
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+
+    m_generic->copy(a, m_doubleInput, samples);
+    m_kernels->copy(b, m_doubleInput, samples);
+
+    // Including what's past the end (i.e. untouched)
+    if (memcmp(a, b, sizeof(a))) Fail("copy", samples, 0.0);
+  }
+
+  void TestAmplify(TestRandom *pRnd, int samples)
+  {
+    const float gain = pRnd->Next(0.0f, 2.0f);
+
+    for (int withEnvelope = 0; withEnvelope < 2; withEnvelope++)
+    {
+      const float *envelope = withEnvelope ? m_envelope : NULL;
+
+      float a[kMaxSamples], b[kMaxSamples];
+      memcpy(a, m_input, sizeof(a));
+      memcpy(b, m_input, sizeof(b));
+
+      m_generic->amplify(a, envelope, gain, samples);
+      m_kernels->amplify(b, envelope, gain, samples);
+
+      if (memcmp(a, b, sizeof(a))) Fail(withEnvelope ? "amplify" : "amplify (no envelope)", samples, 0.0);
+    }
+  }
+
+  void TestMix(TestRandom *pRnd, int samples)
+  {
+    const float gain = pRnd->Next(0.0f, 1.0f);
+
+    float a[kMaxSamples], b[kMaxSamples];
+    memcpy(a, m_input, sizeof(a));
+    memcpy(b, m_input, sizeof(b));
+
+    m_generic->mix(a, m_input2, gain, samples);
+    m_kernels->mix(b, m_input2, gain, samples);
+
+    Compare("mix", a, b, samples, kFMATolerance, false);
+  }
+
+  void TestDelayLine(TestRandom *pRnd, int samples)
+  {
+    const int writePos = (int)pRnd->Next(0.0f, kDelaySize - 1.0f);
+
+    float a[kMaxSamples], b[kMaxSamples];
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+
+    m_generic->delayLine(a, m_delayBuffer, kDelaySize - 1, writePos, m_delay, samples);
+    m_kernels->delayLine(b, m_delayBuffer, kDelaySize - 1, writePos, m_delay, samples);
+
+    Compare("delayLine", a, b, samples, kFMATolerance, false);
+  }
+
+  void TestLowPass(TestRandom *pRnd, int samples)
+  {
+    LowPassFilterState state;
+    memset(&state, 0, sizeof(state));
+
+    state.sampleRate = 44100.0f;
+    state.cutoffFrequency = pRnd->Next(20.0f, 20000.0f);
+    state.resonance = pRnd->Next(0.5f, 4.0f);
+    state.resonanceTarget = pRnd->Next(0.5f, 4.0f);
+    state.smoothingFactor = 0.01f;
+    state.controlRate = pRnd->Next() < 0.5f ? 1 : 16;
+    state.controlCounter = (int)pRnd->Next(1.0f, (float)state.controlRate);
+
+    state.x1 = pRnd->Next(-1.0f, 1.0f);
+    state.x2 = pRnd->Next(-1.0f, 1.0f);
+    state.y1 = pRnd->Next(-1.0f, 1.0f);
+    state.y2 = pRnd->Next(-1.0f, 1.0f);
+    LowPassCalculateCoefficients(&state);
+
+    LowPassFilterState stateA = state, stateB = state;
+    double a[kMaxSamples], b[kMaxSamples];
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+
+    m_generic->lowPass(a, m_input, m_cutoff, samples, &stateA);
+    m_kernels->lowPass(b, m_input, m_cutoff, samples, &stateB);
+
+    // Relative to the peak, resonance can amplify quite a bit
+    double maxDiff = 0.0, peak = 1.0;
+    for (int i = 0; i < kMaxSamples; i++)
+    {
+      double diff = fabs(a[i] - b[i]);
+      if (diff > maxDiff) maxDiff = diff;
+      if (fabs(a[i]) > peak) peak = fabs(a[i]);
+    }
+    maxDiff /= peak;
+
+    if (maxDiff > kLowPassTolerance || stateA.controlCounter != stateB.controlCounter) Fail("lowPass", samples, maxDiff);
+  }
+
+  void TestEnvelope(TestRandom *pRnd, int samples)
+  {
+    EnvelopeState state;
+    state.attackTime = pRnd->Next(0.001f, 0.5f);
+    state.decayTime = pRnd->Next(0.001f, 0.5f);
+    state.sustainLevel = pRnd->Next();
+    state.releaseTime = pRnd->Next(0.001f, 0.5f);
+    state.sampleRate = 44100.0f;
+
+    // Anywhere from the attack into the release
+    state.noteOnTime = -pRnd->Next(0.0f, 1.5f);
+    const int start = (int)pRnd->Next(0.0f, 64.0f);
+
+    float a[kMaxSamples], b[kMaxSamples];
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+
+    m_generic->envelope(a, samples, start, &state);
+    m_kernels->envelope(b, samples, start, &state);
+
+    Compare("envelope", a, b, samples, kEnvelopeTolerance, false);
+  }
+
+  void TestSawtooth(TestRandom *pRnd, int samples)
+  {
+    SawtoothState state;
+    state.phase = pRnd->Next();
+    state.phaseIncrement = pRnd->Next(20.0f, 5000.0f) / 44100.0f;
+
+    for (int antiAliasing = 0; antiAliasing < 2; antiAliasing++)
+    {
+      state.antiAliasing = antiAliasing != 0;
+
+      SawtoothState stateA = state, stateB = state;
+      float a[kMaxSamples], b[kMaxSamples];
+      memset(a, 0, sizeof(a));
+      memset(b, 0, sizeof(b));
+
+      m_generic->sawtooth(a, samples, &stateA);
+      m_kernels->sawtooth(b, samples, &stateB);
+
+      // The phase tolerance times the steepest slope (PolyBLEP's), and
+      // without anti-aliasing a wrap can be a sample apart, when the phases
+      // round to either side of 1
+      const float tolerance = kPhaseTolerance * (2.0f + 2.0f / state.phaseIncrement);
+      Compare(antiAliasing ? "sawtooth" : "sawtooth (no anti-aliasing)", a, b, samples, tolerance, !antiAliasing);
+
+      float phaseDiff = fabsf(stateA.phase - stateB.phase);
+      if (phaseDiff > 0.5f) phaseDiff = 1.0f - phaseDiff;
+      if (phaseDiff > kPhaseTolerance) Fail("sawtooth (end phase)", samples, phaseDiff);
+    }
+  }
+
+  // Also checks that nothing past the end was touched.
+  void Compare(const char *name, const float *a, const float *b, int samples, float tolerance, bool wraps)
+  {
+    if (memcmp(&a[samples], &b[samples], (kMaxSamples - samples) * sizeof(float))) Fail(name, samples, 0.0);
+
+    float maxDiff = 0.0f;
+    for (int i = 0; i < samples; i++)
+    {
+      float diff = fabsf(a[i] - b[i]);
+      if (wraps && fabsf(diff - 2.0f) < diff) diff = fabsf(diff - 2.0f);
+      if (diff > maxDiff) maxDiff = diff;
+    }
+
+    if (maxDiff > tolerance) Fail(name, samples, maxDiff);
+  }
+
+  void Fail(const char *kernel, int samples, double maxDiff)
+  {
+    if (m_failed++ < 20) printf("  %s, %d samples: max diff %g\n", kernel, samples, maxDiff);
+  }
+
+  const DSPKernels *m_kernels, *m_generic;
+  int m_failed;
+
+  float m_input[kMaxSamples], m_input2[kMaxSamples];
+  float m_envelope[kMaxSamples], m_cutoff[kMaxSamples], m_delay[kMaxSamples];
+  float m_delayBuffer[kDelaySize];
+  double m_doubleInput[kMaxSamples];
+};
+
+int main(int argc, char **argv)
+{
+  int numTrials = argc > 1 ? atoi(argv[1]) : 100;
+  if (numTrials < 1) numTrials = 1;
+
+  int failed = 0;
+  for (int variant = kDSPKernelsGeneric + 1; variant < kNumDSPKernels; variant++)
+  {
+    const DSPKernels *pKernels = DSPKernels::Get(variant);
+    if (!pKernels) continue;
+
+    printf("%s\n", pKernels->name);
+
+    KernelTest test(pKernels);
+    TestRandom rnd(1);
+
+    // Up to 64 samples (e.g. SawtoothSynth's chunks), with any tail
+    for (int trial = 0; trial < numTrials; trial++)
+    {
+      for (int samples = 0; samples <= kMaxSamples; samples++) test.Run(&rnd, samples);
+    }
+
+    if (test.Failed()) printf("  %d failure(s)\n", test.Failed());
+    failed += test.Failed();
+  }
+
+  if (failed)
+  {
+    printf("FAILED: Kernels differ from the generic kernels\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -2,7 +2,6 @@
 #include "IPlug/IPlug_include_in_plug_src.h"
 
 #include "WDL/denormal.h"
-#include <string.h>
 
 class IKnobCustomControl: public IKnobMultiControl
 {
@@ -17,28 +16,303 @@ public:
 	}
 };
 
+// Output waveform/spectrum, filter response, envelope/LFO state, and the
+// note cache hit rate. Reads the scope feed (which never blocks the audio
+// thread), all analysis and drawing is done here in the GUI thread. The
+// background has no room for it, so it's an overlay, hidden until shown by
+// IScopeButtonControl.
+class IScopeControl: public IControl
+{
+public:
+	IScopeControl(IPlugBase *pPlug, IRECT *pR, const ScopeFeed *pFeed)
+	: IControl(pPlug, pR), mFeed(pFeed), mVisible(false) {}
+
+	void Toggle()
+	{
+		mVisible = !mVisible;
+		Redraw();
+	}
+
+	bool IsVisible() const { return mVisible; }
+
+	// Redraw on every GUI timer tick while visible
+	bool IsDirty() { return mVisible || IControl::IsDirty(); }
+
+	bool Draw(IGraphics *pGraphics)
+	{
+		if (!mVisible) return true;
+
+		static const IColor background(255, 24, 24, 24), grid(255, 56, 56, 56);
+		static const IColor wave(255, 96, 208, 255), spectrum(255, 128, 128, 128), response(255, 255, 160, 48);
+		static const IColor envelope(255, 96, 224, 96), lfo(255, 224, 96, 224);
+
+		pGraphics->FillIRect(&background, &mRECT);
+
+		const int meterHeight = 24;
+		IRECT waveRect(mRECT.L, mRECT.T, mRECT.R, mRECT.T + (mRECT.H() - meterHeight) / 2);
+		IRECT freqRect(mRECT.L, waveRect.B, mRECT.R, mRECT.B - meterHeight);
+		IRECT meterRect(mRECT.L, freqRect.B, mRECT.R, mRECT.B);
+
+		float samples[kSpectrumSize];
+		int n = mFeed->ReadSamples(samples, kSpectrumSize);
+
+		ScopeSnapshot snapshot;
+		if (!mFeed->ReadSnapshot(&snapshot)) return true;
+
+		DrawWaveform(pGraphics, &waveRect, samples, n, &grid, &wave);
+		DrawSpectrum(pGraphics, &freqRect, samples, n, &snapshot, &grid, &spectrum, &response);
+
+		// Envelope level, and LFO position (relative to its max depth)
+		IRECT envRect(meterRect.L, meterRect.T + 4, meterRect.L + (int)(meterRect.W() / 2 * snapshot.envelope), meterRect.B - 4);
+		pGraphics->FillIRect(&envelope, &envRect);
+
+		int center = meterRect.L + meterRect.W() * 3 / 4;
+		int pos = center + (int)(meterRect.W() / 4 * snapshot.lfo / 1000.0f);
+		IRECT lfoRect(pos - 2, meterRect.T + 4, pos + 2, meterRect.B - 4);
+		pGraphics->FillIRect(&lfo, &lfoRect);
+
+		// Note cache hit rate (since loaded), while it's on
+		if (snapshot.noteCacheHitRate >= 0.0f)
+		{
+			char str[32];
+			sprintf(str, "Note cache %.0f%%", 100.0f * snapshot.noteCacheHitRate);
+
+			IText text(12, &spectrum, NULL, IText::kStyleNormal, IText::kAlignFar);
+			IRECT textRect(waveRect.R - 120, waveRect.T + 4, waveRect.R - 4, waveRect.T + 16);
+			pGraphics->DrawIText(&text, str, &textRect);
+		}
+
+		return true;
+	}
+
+private:
+	static const int kWaveSamples = 512;
+	static const int kSpectrumSize = 1024;
+	static const int kSpectrumBins = 128;
+
+	// Triggered on a rising zero crossing, so periodic waveforms stand still
+	void DrawWaveform(IGraphics *pGraphics, const IRECT *pR, const float *samples, int n, const IColor *pGrid, const IColor *pColor)
+	{
+		float mid = 0.5f * (pR->T + pR->B);
+		pGraphics->DrawLine(pGrid, pR->L, mid, pR->R, mid);
+
+		if (n < kWaveSamples) return;
+
+		int start = n - kWaveSamples;
+		for (int i = start; i > 0; i--)
+		{
+			if (samples[i - 1] < 0.0f && samples[i] >= 0.0f)
+			{
+				start = i;
+				break;
+			}
+		}
+
+		float scale = (float)pR->H(); // -6 dB full scale
+		float step = (float)pR->W() / (kWaveSamples - 1);
+
+		for (int i = 1; i < kWaveSamples; i++)
+		{
+			float y0 = BoundedY(pR, mid - samples[start + i - 1] * scale);
+			float y1 = BoundedY(pR, mid - samples[start + i] * scale);
+			pGraphics->DrawLine(pColor, pR->L + (i - 1) * step, y0, pR->L + i * step, y1, NULL, true);
+		}
+	}
+
+	// Spectrum (Goertzel at log spaced frequencies) and the current filter
+	// response, 20 Hz to Nyquist, -96 to +12 dB
+	void DrawSpectrum(IGraphics *pGraphics, const IRECT *pR, const float *samples, int n, const ScopeSnapshot *pSnapshot, const IColor *pGrid, const IColor *pSpectrum, const IColor *pResponse)
+	{
+		const double sampleRate = mFeed->SampleRate();
+		const double fullRate = mPlug->GetSampleRate();
+		const double minFreq = 20.0, maxFreq = 0.5 * sampleRate;
+
+		// Hann window
+		float windowed[kSpectrumSize];
+		double windowSum = 0.0;
+		for (int i = 0; i < n && n > 1; i++)
+		{
+			double w = 0.5 - 0.5 * cos(2.0 * M_PI * i / (n - 1));
+			windowed[i] = (float)(w * samples[i]);
+			windowSum += w;
+		}
+
+		LowPassFilterState filter;
+		filter.cutoffFrequency = pSnapshot->cutoff;
+		filter.resonance = pSnapshot->resonance;
+		filter.sampleRate = fullRate;
+		LowPassCalculateCoefficients(&filter);
+
+		float x0 = 0.0f, spectrum0 = 0.0f, response0 = 0.0f;
+		for (int bin = 0; bin < kSpectrumBins; bin++)
+		{
+			double freq = minFreq * pow(maxFreq / minFreq, (double)bin / (kSpectrumBins - 1));
+			float x = pR->L + (float)pR->W() * bin / (kSpectrumBins - 1);
+
+			float spectrumY = pR->B;
+			if (n > 1)
+			{
+				double coeff = 2.0 * cos(2.0 * M_PI * freq / sampleRate), s1 = 0.0, s2 = 0.0;
+				for (int i = 0; i < n; i++)
+				{
+					double s0 = windowed[i] + coeff * s1 - s2;
+					s2 = s1;
+					s1 = s0;
+				}
+
+				double power = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+				double mag = 2.0 * sqrt(power > 0.0 ? power : 0.0) / windowSum;
+				spectrumY = DBToY(pR, 20.0 * log10(mag + 1e-9));
+			}
+
+			// |H(e^jw)| of the biquad
+			double w = 2.0 * M_PI * freq / fullRate;
+			double numRe = filter.b0 + filter.b1 * cos(w) + filter.b2 * cos(2.0 * w);
+			double numIm = -(filter.b1 * sin(w) + filter.b2 * sin(2.0 * w));
+			double denRe = 1.0 + filter.a1 * cos(w) + filter.a2 * cos(2.0 * w);
+			double denIm = -(filter.a1 * sin(w) + filter.a2 * sin(2.0 * w));
+			double gain = sqrt((numRe * numRe + numIm * numIm) / (denRe * denRe + denIm * denIm + 1e-18));
+			float responseY = DBToY(pR, 20.0 * log10(gain + 1e-9));
+
+			if (bin)
+			{
+				pGraphics->DrawLine(pSpectrum, x0, spectrum0, x, spectrumY, NULL, true);
+				pGraphics->DrawLine(pResponse, x0, response0, x, responseY, NULL, true);
+			}
+
+			x0 = x;
+			spectrum0 = spectrumY;
+			response0 = responseY;
+		}
+
+		// Cutoff frequency marker
+		if (pSnapshot->cutoff > minFreq && pSnapshot->cutoff < maxFreq)
+		{
+			float x = pR->L + (float)pR->W() * log(pSnapshot->cutoff / minFreq) / log(maxFreq / minFreq);
+			pGraphics->DrawLine(pGrid, x, pR->T, x, pR->B);
+		}
+	}
+
+	static float BoundedY(const IRECT *pR, float y)
+	{
+		return y < pR->T ? pR->T : y > pR->B ? pR->B : y;
+	}
+
+	static float DBToY(const IRECT *pR, double dB)
+	{
+		return BoundedY(pR, pR->T + (float)((12.0 - dB) / 108.0) * pR->H());
+	}
+
+	const ScopeFeed *mFeed;
+	bool mVisible;
+};
+
+// Small waveform icon that shows/hides the scope, lit while it's shown.
+class IScopeButtonControl: public IControl
+{
+public:
+	IScopeButtonControl(IPlugBase *pPlug, IRECT *pR, IScopeControl *pScope)
+	: IControl(pPlug, pR), mScope(pScope) {}
+
+	bool Draw(IGraphics *pGraphics)
+	{
+		static const IColor off(255, 128, 128, 128), on(255, 96, 208, 255);
+		const IColor *pColor = mScope->IsVisible() ? &on : &off;
+
+		float l = (float)mRECT.L, t = (float)mRECT.T, r = (float)(mRECT.R - 1), b = (float)(mRECT.B - 1);
+		pGraphics->DrawLine(pColor, l, t, r, t);
+		pGraphics->DrawLine(pColor, r, t, r, b);
+		pGraphics->DrawLine(pColor, r, b, l, b);
+		pGraphics->DrawLine(pColor, l, b, l, t);
+
+		// One sine cycle
+		const int n = 16;
+		float mid = 0.5f * (t + b), amp = 0.3f * (b - t);
+		for (int i = 1; i <= n; i++)
+		{
+			float x0 = l + 4 + (r - l - 8) * (i - 1) / n, x1 = l + 4 + (r - l - 8) * i / n;
+			float y0 = mid - amp * (float)sin(2.0 * M_PI * (i - 1) / n), y1 = mid - amp * (float)sin(2.0 * M_PI * i / n);
+			pGraphics->DrawLine(pColor, x0, y0, x1, y1, NULL, true);
+		}
+
+		return true;
+	}
+
+	void OnMouseDown(int x, int y, IMouseMod *pMod)
+	{
+		mScope->Toggle();
+		Redraw();
+	}
+
+private:
+	IScopeControl *mScope;
+};
+
 DrMixAISynth::DrMixAISynth(void *instance):
   IPLUG_CTOR(kNumParams, 1, instance),
   m_synth(new SawtoothSynth()),
+  m_qualityTier(kQualityFull),
   m_note_on(-1)
 {
   // Plugin parameters
 
-  IBoolParam *pBypassParam = new IBoolParam("Bypass", false);
-  pBypassParam->SetGlobal(true);
-  AddParam(kParamBypass, pBypassParam);
+  for (int i = 0; i < kNumSynthParams; i++)
+  {
+    const SynthParamInfo *pInfo = &kSynthParams[i];
+
+    switch (pInfo->type)
+    {
+      case kSynthParamBool:
+      {
+        IBoolParam *pBoolParam = new IBoolParam(pInfo->name, pInfo->defaultValue >= 0.5);
+        if (i == kParamBypass) pBoolParam->SetGlobal(true);
+        AddParam(i, pBoolParam);
+        break;
+      }
+
+      case kSynthParamExp:
+      {
+        AddParam(i, new IDoubleExpParam(pInfo->shape, pInfo->name, pInfo->defaultValue, pInfo->minValue, pInfo->maxValue, pInfo->displayPrecision, pInfo->label));
+        break;
+      }
+
+      default:
+      {
+        AddParam(i, new IDoubleParam(pInfo->name, pInfo->defaultValue, pInfo->minValue, pInfo->maxValue, pInfo->displayPrecision, pInfo->label));
+        break;
+      }
+    }
+  }
 
-  AddParam(kParamEnvelope, new IBoolParam("Envelope", false));
-  AddParam(kParamAttackTime, new IDoubleExpParam(3, "Attack", 100, 1, 5000, 0, "ms"));
-  AddParam(kParamDecayTime, new IDoubleExpParam(3, "Decay", 200, 1, 5000, 0, "ms"));
-  AddParam(kParamSustainLevel, new IDoubleParam("Sustain", -6.0, -72.0, 0.0, 1, "dB"));
-  AddParam(kParamReleaseTime, new IDoubleExpParam(3, "Release", 300, 1, 5000, 0, "ms"));
+  // Effects bus (no GUI controls, host automation only)
 
-  AddParam(kParamCutoffFrequency, new IDoubleExpParam(6, "Cutoff", 20000, 20, 20000, 0, "Hz"));
-  AddParam(kParamResonance, new IDoubleParam("Resonance", 0.5, 0.5, 4.0, 1));
+  AddParam(kParamChorus, new IBoolParam("Chorus", false));
+  AddParam(kParamChorusRate, new IDoubleExpParam(3, "Chorus Rate", 0.8, 0.1, 5, 2, "Hz"));
+  AddParam(kParamChorusDepth, new IDoubleParam("Chorus Depth", 3, 0, 5, 1, "ms"));
+  AddParam(kParamChorusMix, new IDoubleParam("Chorus Mix", 50, 0, 100, 0, "%"));
 
-  AddParam(kParamLFOFrequency, new IDoubleExpParam(3, "LFO Rate", 2, 0.1, 10, 2, "Hz"));
-  AddParam(kParamLFOAmplitude, new IDoubleParam("LFO Depth", 0, 0, 1000, 0, "Hz"));
+  AddParam(kParamDelay, new IBoolParam("Delay", false));
+  AddParam(kParamDelayTime, new IDoubleExpParam(3, "Delay Time", 375, 10, 2000, 0, "ms"));
+  AddParam(kParamDelaySync, new IBoolParam("Delay Sync", false));
+  AddParam(kParamDelayBeats, new IDoubleParam("Delay Beats", 0.75, 0.125, 2, 3, "beats"));
+  AddParam(kParamDelayFeedback, new IDoubleParam("Delay Feedback", 40, 0, 95, 0, "%"));
+  AddParam(kParamDelayMix, new IDoubleParam("Delay Mix", 30, 0, 100, 0, "%"));
+
+  // Lower quality instead of dropping out when close to the deadline (but
+  // not while rendering ahead, i.e. offline)
+  AddParam(kParamGovernor, new IBoolParam("CPU Governor", true));
+
+  // Use another core during offline bounce (not realtime safe, and the host's
+  // offline state isn't available, so turn it off again for live playback)
+  AddParam(kParamRenderAhead, new IBoolParam("Render Ahead", false));
+
+  // Play back recorded note attacks, the start phase policy makes them
+  // repeatable
+  IEnumParam *pNoteCacheParam = new IEnumParam("Note Cache", kStartPhaseOff, kNumStartPhases);
+  pNoteCacheParam->SetDisplayText(kStartPhaseOff, "Off");
+  pNoteCacheParam->SetDisplayText(kStartPhaseRetrigger, "Retrigger");
+  pNoteCacheParam->SetDisplayText(kStartPhaseFreeLFO, "Free LFO");
+  AddParam(kParamNoteCache, pNoteCacheParam);
 
   MakeDefaultPreset("Default");
 
@@ -97,6 +371,18 @@ DrMixAISynth::DrMixAISynth(void *instance):
   pKnobControl->SetTooltip("LFO Depth");
   pGraphics->AttachControl(pKnobControl);
 
+  // Scope, shown over the artwork (below the title) by the button above the
+  // filter knobs
+
+  IRECT scopeRect(372, 132, 1160, 644);
+  IScopeControl *pScopeControl = new IScopeControl(this, &scopeRect, &m_scope);
+  pGraphics->AttachControl(pScopeControl);
+
+  IRECT scopeButtonRect(222, 30, 292, 58);
+  IControl *pScopeButtonControl = new IScopeButtonControl(this, &scopeButtonRect, pScopeControl);
+  pScopeButtonControl->SetTooltip("Scope On/Off");
+  pGraphics->AttachControl(pScopeButtonControl);
+
   AttachGraphics(pGraphics);
 }
 
@@ -104,92 +390,160 @@ void DrMixAISynth::SetSampleRate(double rate)
 {
   IPlug::SetSampleRate(rate);
   m_synth->SetSampleRate(rate);
+  m_effects.SetSampleRate(rate);
+  m_scope.SetSampleRate(rate);
+  m_noteCache.SetSampleRate(rate);
+  m_governor.SetDeadline(GetBlockSize(), rate);
+  m_renderAhead.Invalidate();
 }
 
 void DrMixAISynth::SetBlockSize(int size)
 {
   IPlug::SetBlockSize(size);
   m_midi_queue.Resize(GetBlockSize(), false);
+  m_governor.SetDeadline(GetBlockSize(), GetSampleRate());
+  m_renderAhead.SetBlockSize(GetBlockSize());
 }
 
 void DrMixAISynth::OnParamChange(int index)
 {
+  m_renderAhead.Invalidate();
+
+  // Continue live before the note cache's recordings become invalid (the
+  // synth catches up to the playback position at the next block, already
+  // with the new params, so not on this thread)
+  bool synthParam = index >= kParamEnvelope && index <= kParamLFOAmplitude;
+  if (synthParam)
+  {
+    m_noteCache.Stop();
+
+    bool gate = m_note_on >= 0;
+    m_synth->SetParam(index, GetParam(index)->Value(), gate);
+  }
+
   switch (index)
   {
-    case kParamEnvelope:
+    case kParamChorus:
     {
       bool enable = GetParam<IBoolParam>(index)->Bool();
-      bool gate = m_note_on >= 0;
-      BypassEnvelope(!enable, gate);
+      m_effects.EnableChorus(enable);
       break;
     }
 
-    case kParamAttackTime:
+    case kParamChorusRate:
     {
-      double attack = GetParam<IDoubleExpParam>(index)->Value() * 0.001;
-      SetAttackTime(attack);
+      double rate = GetParam<IDoubleExpParam>(index)->Value();
+      m_effects.SetChorusRate(rate);
       break;
     }
 
-    case kParamDecayTime:
+    case kParamChorusDepth:
     {
-      double decay = GetParam<IDoubleExpParam>(index)->Value() * 0.001;
-      SetDecayTime(decay);
+      double depth = GetParam<IDoubleParam>(index)->Value() * 0.001;
+      m_effects.SetChorusDepth(depth);
       break;
     }
 
-    case kParamSustainLevel:
+    case kParamChorusMix:
     {
-      double sustain = GetParam<IDoubleParam>(index)->DBToAmp();
-      SetSustainLevel(sustain);
+      double mix = GetParam<IDoubleParam>(index)->Value() * 0.01;
+      m_effects.SetChorusMix(mix);
       break;
     }
 
-    case kParamReleaseTime:
+    case kParamDelay:
     {
-      double release = GetParam<IDoubleExpParam>(index)->Value() * 0.001;
-      SetReleaseTime(release);
+      bool enable = GetParam<IBoolParam>(index)->Bool();
+      m_effects.EnableDelay(enable);
       break;
     }
 
-    case kParamCutoffFrequency:
+    case kParamDelayTime:
     {
-      double cutoff = GetParam<IDoubleExpParam>(index)->Value();
-      SetCutoffFrequency(cutoff);
+      double time = GetParam<IDoubleExpParam>(index)->Value() * 0.001;
+      m_effects.SetDelayTime(time);
       break;
     }
 
-    case kParamResonance:
+    case kParamDelaySync:
     {
-      double resonance = GetParam<IDoubleParam>(index)->Value();
-      SetResonance(resonance);
+      bool sync = GetParam<IBoolParam>(index)->Bool();
+      m_effects.SetDelaySync(sync);
       break;
     }
 
-    case kParamLFOFrequency:
+    case kParamDelayBeats:
     {
-      double rate = GetParam<IDoubleExpParam>(index)->Value();
-      SetLFOFrequency(rate);
+      double beats = GetParam<IDoubleParam>(index)->Value();
+      m_effects.SetDelayBeats(beats);
+      break;
+    }
+
+    case kParamDelayFeedback:
+    {
+      double feedback = GetParam<IDoubleParam>(index)->Value() * 0.01;
+      m_effects.SetDelayFeedback(feedback);
+      break;
+    }
+
+    case kParamDelayMix:
+    {
+      double mix = GetParam<IDoubleParam>(index)->Value() * 0.01;
+      m_effects.SetDelayMix(mix);
+      break;
+    }
+
+    case kParamGovernor:
+    case kParamRenderAhead:
+    {
+      bool renderAhead = GetParam<IBoolParam>(kParamRenderAhead)->Bool();
+      m_renderAhead.SetEnabled(renderAhead);
+
+      // An offline bounce shouldn't depend on how busy the machine is
+      bool governor = GetParam<IBoolParam>(kParamGovernor)->Bool();
+      m_governor.SetEnabled(governor && !renderAhead);
       break;
     }
 
-    case kParamLFOAmplitude:
+    case kParamNoteCache:
     {
-      double depth = GetParam<IDoubleParam>(index)->Value();
-      SetLFOAmplitude(depth);
+      int policy = GetParam<IEnumParam>(index)->Int();
+      m_noteCache.SetStartPhase(policy);
       break;
     }
   }
+
+  if (synthParam) m_noteCache.SetParamHash(SynthParamHash());
+}
+
+// FNV-1a of the params that affect the synth's output.
+unsigned int DrMixAISynth::SynthParamHash()
+{
+  unsigned int hash = 2166136261u;
+
+  for (int i = kParamEnvelope; i <= kParamLFOAmplitude; i++)
+  {
+    double value = GetParam(i)->Value();
+
+    const unsigned char *p = (const unsigned char*)&value;
+    for (size_t j = 0; j < sizeof(value); j++) hash = (hash ^ p[j]) * 16777619u;
+  }
+
+  return hash;
 }
 
 void DrMixAISynth::Reset()
 {
   m_synth->Reset();
+  m_effects.Reset();
+  m_renderAhead.Invalidate();
+  m_noteCache.Cancel();
 }
 
 void DrMixAISynth::ProcessMidiMsg(const IMidiMsg *msg)
 {
   m_midi_queue.Add(msg);
+  m_renderAhead.Invalidate();
 }
 
 void DrMixAISynth::ProcessMidiQueue(const IMidiMsg *msg)
@@ -206,6 +560,7 @@ void DrMixAISynth::ProcessMidiQueue(const IMidiMsg *msg)
 
       m_note_on = note;
       m_synth->Attack();
+      m_noteCache.NoteOn(m_synth, note);
       break;
     }
 
@@ -236,7 +591,15 @@ void DrMixAISynth::ProcessDoubleReplacing(const double *const *inputs, double *c
   bool pluginIsBypassed = IsBypassed() || GetParam<IBoolParam>(kParamBypass)->Bool();
   bool envelopIsEnabled = !m_synth->EnvelopeIsBypassed();
 
-  for (int offset = 0; offset < samples;)
+  // Use the block rendered ahead if nothing changed since, or else render
+  // it now
+  bool gate = !pluginIsBypassed && (m_note_on >= 0 || envelopIsEnabled);
+  int offset = m_renderAhead.Take(m_synth, gate, outputs[0], samples) ? samples : 0;
+
+  // Not counting the wait for the block rendered ahead
+  m_governor.BeginBlock();
+
+  while (offset < samples)
   {
     int next;
 
@@ -258,15 +621,54 @@ void DrMixAISynth::ProcessDoubleReplacing(const double *const *inputs, double *c
     }
 
     int block = next - offset;
-    bool gate = !pluginIsBypassed && (m_note_on >= 0 || envelopIsEnabled);
+    gate = !pluginIsBypassed && (m_note_on >= 0 || envelopIsEnabled);
     Process(&outputs[0][offset], block, gate);
 
     offset = next;
   }
 
-  memcpy(outputs[1], outputs[0], samples * sizeof(double));
+  // Render ahead the next block (while the effects and the host run), unless
+  // there are MIDI events queued for it, or the note cache is in use
+  if (m_renderAhead.IsEnabled() && m_midi_queue.Empty() && !m_noteCache.IsActive())
+  {
+    gate = !pluginIsBypassed && (m_note_on >= 0 || !m_synth->EnvelopeIsBypassed());
+    m_renderAhead.Start(m_synth, gate, samples);
+  }
+
+  // Mono to stereo, through the effects bus only when it's on
+  if (m_effects.IsEnabled())
+  {
+    m_effects.SetTempo(GetTempo());
+    m_effects.Process(m_synth->Kernels(), outputs[0], outputs[1], samples);
+  }
+  else
+  {
+    m_synth->Kernels()->copy(outputs[1], outputs[0], samples);
+  }
+
+  // Feed the scope (also while the GUI is closed, for other readers)
+  NoteCacheModulation modulation;
+  m_noteCache.Modulation(m_synth, &modulation);
+
+  ScopeSnapshot snapshot;
+  snapshot.envelope = modulation.envelope;
+  snapshot.lfo = modulation.lfo;
+  snapshot.cutoff = modulation.cutoff;
+  snapshot.resonance = modulation.resonance;
+  snapshot.gate = !pluginIsBypassed && m_note_on >= 0;
+  snapshot.noteCacheHitRate = m_noteCache.StartPhase() != kStartPhaseOff ? (float)m_noteCache.HitRate() : -1.0f;
+  m_scope.Publish(outputs[0], samples, snapshot);
 
   m_midi_queue.Flush(samples);
+
+  int tier = m_governor.EndBlock(samples);
+  if (tier != m_qualityTier)
+  {
+    m_synth->SetQuality(tier);
+    m_noteCache.SetQuality(tier);
+    m_qualityTier = tier;
+    m_renderAhead.Invalidate();
+  }
 }
 
 bool DrMixAISynth::OnGUIRescale(int wantScale)
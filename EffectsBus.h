@@ -0,0 +1,342 @@
+#pragma once
+
+// Post-voice stereo effects bus (chorus -> delay), runs once per plugin
+// instance on the mono synth output.
+
+#include <math.h>
+#include <string.h>
+
+#include "WDL/heapbuf.h"
+
+#include "DSPKernels.h"
+
+// Power of 2 delay line buffer, allocated once (at SetSampleRate).
+//
+// Resetting doesn't clear the buffer (up to a few MB, too much for the
+// audio thread), instead what hasn't been written since reads as silence.
+class DelayLineBuffer {
+public:
+  DelayLineBuffer() : m_mask(0), m_writePos(0), m_filled(0) {}
+
+  void setMaxDelay(int samples) {
+    int size = 1;
+    while (size < samples) size <<= 1;
+
+    m_buffer.Resize(size, false);
+    m_mask = size - 1;
+    reset();
+  }
+
+  void reset() {
+    m_writePos = 0;
+    m_filled = 0;
+  }
+
+  void write(const float *input, int samples) {
+    float *buffer = m_buffer.Get();
+    for (int i = 0; i < samples; i++) buffer[(m_writePos + i) & m_mask] = input[i];
+  }
+
+  // Read delay[i] samples before the (to be) written input[i].
+  void read(const DSPKernels *dsp, float *output, const float *delay, int samples) const {
+    dsp->delayLine(output, m_buffer.Get(), m_mask, m_writePos, delay, samples);
+    if (m_filled > m_mask) return;
+
+    // Redo reads (partly) before the reset, with silence there
+    const float *buffer = m_buffer.Get();
+    for (int i = 0; i < samples; i++) {
+      int n = (int)delay[i];
+      if (n + 1 <= m_filled + i) continue;
+
+      float frac = delay[i] - n;
+      int j = (m_writePos + i - n) & m_mask;
+      float a = n <= m_filled + i ? buffer[j] : 0.0f;
+      output[i] = a - a * frac;
+    }
+  }
+
+  void advance(int samples) {
+    m_writePos = (m_writePos + samples) & m_mask;
+    m_filled = m_filled + samples < m_mask + 1 ? m_filled + samples : m_mask + 1;
+  }
+
+private:
+  WDL_TypedBuf<float> m_buffer;
+  int m_mask;
+  int m_writePos;
+  int m_filled; // Samples written (before m_writePos) since reset
+};
+
+static const float kChorusBaseDelay = 0.007f; // 7 ms
+static const float kChorusMaxDepth = 0.005f; // 5 ms
+
+class StereoChorus {
+public:
+  StereoChorus() :
+    m_rate(0.8),
+    m_depth(0.003),
+    m_mix(0.5),
+    m_sampleRate(44100),
+    m_phase(0.0)
+  {}
+
+  void setSampleRate(float sampleRate) {
+    m_sampleRate = sampleRate;
+    m_line.setMaxDelay((int)((kChorusBaseDelay + kChorusMaxDepth) * sampleRate) + kMaxBlockSize + 2);
+    m_phase = 0.0;
+  }
+
+  void setRate(float rate) { m_rate = rate; }
+  void setDepth(float depth) { m_depth = depth < kChorusMaxDepth ? depth : kChorusMaxDepth; }
+  void setMix(float mix) { m_mix = mix; }
+
+  void reset() {
+    m_line.reset();
+    m_phase = 0.0;
+  }
+
+  // Process (up to kMaxBlockSize) mono input samples into stereo output.
+  void process(const DSPKernels *dsp, float *left, float *right, const float *input, int samples) {
+    m_line.write(input, samples);
+
+    // LFO at control rate, linearly interpolated across the block, with the
+    // right channel 90 degrees ahead
+    float phaseEnd = m_phase + m_rate / m_sampleRate * samples;
+    float delay[kMaxBlockSize];
+
+    fillDelay(delay, m_phase, phaseEnd, samples);
+    m_line.read(dsp, left, delay, samples);
+
+    fillDelay(delay, m_phase + 0.25, phaseEnd + 0.25, samples);
+    m_line.read(dsp, right, delay, samples);
+
+    m_line.advance(samples);
+    m_phase = phaseEnd - (int)phaseEnd;
+
+    // Dry/wet crossfade
+    dsp->amplify(left, NULL, m_mix, samples);
+    dsp->mix(left, input, 1.0 - m_mix, samples);
+    dsp->amplify(right, NULL, m_mix, samples);
+    dsp->mix(right, input, 1.0 - m_mix, samples);
+  }
+
+  static const int kMaxBlockSize = 64;
+
+private:
+  void fillDelay(float *delay, float phaseStart, float phaseEnd, int samples) {
+    float baseDelay = kChorusBaseDelay * m_sampleRate;
+    float depth = 0.5 * m_depth * m_sampleRate;
+
+    float start = baseDelay + depth * (1.0 + sin(2.0 * M_PI * phaseStart));
+    float end = baseDelay + depth * (1.0 + sin(2.0 * M_PI * phaseEnd));
+    float step = (end - start) / samples;
+
+    for (int i = 0; i < samples; i++) delay[i] = start + step * i;
+  }
+
+  DelayLineBuffer m_line;
+
+  float m_rate; // Hz
+  float m_depth; // Seconds
+  float m_mix;
+
+  float m_sampleRate;
+  float m_phase;
+};
+
+static const float kDelayMaxTime = 2.0f; // 2 s
+
+// Ping-pong delay, the input feeds the left channel, and the echoes
+// alternate between left and right.
+class StereoDelay {
+public:
+  StereoDelay() :
+    m_time(0.375),
+    m_feedback(0.4),
+    m_mix(0.3),
+    m_sampleRate(44100),
+    m_delay(0.375 * 44100)
+  {}
+
+  void setSampleRate(float sampleRate) {
+    m_sampleRate = sampleRate;
+
+    int maxDelay = (int)(kDelayMaxTime * sampleRate) + 2;
+    m_left.setMaxDelay(maxDelay);
+    m_right.setMaxDelay(maxDelay);
+
+    m_delay = targetDelay();
+  }
+
+  // Delay time in seconds (up to kDelayMaxTime).
+  void setTime(float time) { m_time = time < kDelayMaxTime ? time : kDelayMaxTime; }
+  void setFeedback(float feedback) { m_feedback = feedback; }
+  void setMix(float mix) { m_mix = mix; }
+
+  void reset() {
+    m_left.reset();
+    m_right.reset();
+    m_delay = targetDelay();
+  }
+
+  // Process (up to kMaxBlockSize) stereo samples in-place.
+  void process(const DSPKernels *dsp, float *left, float *right, int samples) {
+    // Glide towards delay time changes (tape style), once per block
+    float delayEnd = m_delay + (targetDelay() - m_delay) * 0.05f;
+    float step = (delayEnd - m_delay) / samples;
+
+    float delay[kMaxBlockSize];
+    for (int i = 0; i < samples; i++) delay[i] = m_delay + step * i;
+    m_delay = delayEnd;
+
+    // The delay is at least one block, so it only reads previous blocks
+    float delayedLeft[kMaxBlockSize], delayedRight[kMaxBlockSize];
+    m_left.read(dsp, delayedLeft, delay, samples);
+    m_right.read(dsp, delayedRight, delay, samples);
+
+    float input[kMaxBlockSize];
+    for (int i = 0; i < samples; i++) input[i] = 0.5f * (left[i] + right[i]);
+
+    dsp->mix(input, delayedRight, m_feedback, samples);
+    m_left.write(input, samples);
+
+    memcpy(input, delayedLeft, samples * sizeof(float));
+    dsp->amplify(input, NULL, m_feedback, samples);
+    m_right.write(input, samples);
+
+    m_left.advance(samples);
+    m_right.advance(samples);
+
+    dsp->mix(left, delayedLeft, m_mix, samples);
+    dsp->mix(right, delayedRight, m_mix, samples);
+  }
+
+  static const int kMaxBlockSize = 64;
+
+private:
+  float targetDelay() const {
+    float delay = m_time * m_sampleRate;
+    return delay > (float)kMaxBlockSize ? delay : (float)kMaxBlockSize;
+  }
+
+  DelayLineBuffer m_left, m_right;
+
+  float m_time; // Seconds
+  float m_feedback;
+  float m_mix;
+
+  float m_sampleRate;
+  float m_delay; // Samples, smoothed
+};
+
+class EffectsBus
+{
+public:
+  EffectsBus() :
+    m_chorusEnabled(false),
+    m_delayEnabled(false),
+    m_delayTime(0.375),
+    m_delaySync(false),
+    m_delayBeats(0.75),
+    m_tempo(120.0)
+  {
+    SetSampleRate(44100);
+  }
+
+  void SetSampleRate(double rate)
+  {
+    // (Re)allocates the delay lines, so not from the audio thread
+    m_chorus.setSampleRate(rate);
+    m_delay.setSampleRate(rate);
+  }
+
+  // Effects that are off don't run, so their delay lines are stale when
+  // they are switched back on.
+  void EnableChorus(bool enable)
+  {
+    if (enable && !m_chorusEnabled) m_chorus.reset();
+    m_chorusEnabled = enable;
+  }
+
+  void SetChorusRate(double rate) { m_chorus.setRate(rate); }
+  void SetChorusDepth(double depth) { m_chorus.setDepth(depth); }
+  void SetChorusMix(double mix) { m_chorus.setMix(mix); }
+
+  void EnableDelay(bool enable)
+  {
+    if (enable && !m_delayEnabled) m_delay.reset();
+    m_delayEnabled = enable;
+  }
+
+  void SetDelayTime(double time) { m_delayTime = time; UpdateDelayTime(); }
+  void SetDelaySync(bool sync) { m_delaySync = sync; UpdateDelayTime(); }
+  void SetDelayBeats(double beats) { m_delayBeats = beats; UpdateDelayTime(); }
+  void SetDelayFeedback(double feedback) { m_delay.setFeedback(feedback); }
+  void SetDelayMix(double mix) { m_delay.setMix(mix); }
+
+  void SetTempo(double tempo)
+  {
+    if (tempo > 0.0 && tempo != m_tempo)
+    {
+      m_tempo = tempo;
+      UpdateDelayTime();
+    }
+  }
+
+  bool IsEnabled() const { return m_chorusEnabled || m_delayEnabled; }
+
+  void Reset()
+  {
+    m_chorus.reset();
+    m_delay.reset();
+  }
+
+  // Process mono input (in left) to stereo, only call if IsEnabled().
+  void Process(const DSPKernels *dsp, double *left, double *right, int samples)
+  {
+    float input[kChunkSize], bufLeft[kChunkSize], bufRight[kChunkSize];
+
+    for (int offset = 0; offset < samples; offset += kChunkSize)
+    {
+      int chunk = samples - offset < kChunkSize ? samples - offset : kChunkSize;
+
+      for (int i = 0; i < chunk; i++) input[i] = left[offset + i];
+
+      if (m_chorusEnabled)
+      {
+        m_chorus.process(dsp, bufLeft, bufRight, input, chunk);
+      }
+      else
+      {
+        memcpy(bufLeft, input, chunk * sizeof(float));
+        memcpy(bufRight, input, chunk * sizeof(float));
+      }
+
+      if (m_delayEnabled) m_delay.process(dsp, bufLeft, bufRight, chunk);
+
+      for (int i = 0; i < chunk; i++)
+      {
+        left[offset + i] = bufLeft[i];
+        right[offset + i] = bufRight[i];
+      }
+    }
+  }
+
+private:
+  static const int kChunkSize = 64;
+
+  void UpdateDelayTime()
+  {
+    m_delay.setTime(m_delaySync ? m_delayBeats * 60.0 / m_tempo : m_delayTime);
+  }
+
+  StereoChorus m_chorus;
+  StereoDelay m_delay;
+
+  bool m_chorusEnabled, m_delayEnabled;
+
+  double m_delayTime; // Seconds
+  bool m_delaySync;
+  double m_delayBeats;
+  double m_tempo; // BPM
+};
@@ -0,0 +1,403 @@
+#pragma once
+
+// Cache of rendered note attacks, for patterns that retrigger the same note
+// over and over. With the cache on, each note on restarts the voice from a
+// known state (the start phase policy), so the first part of a note only
+// depends on the note and the synth params. The first time that part is
+// rendered live and recorded, along with the synth state at its end. After
+// that the recording is played back, and then the voice continues live
+// from the recorded state, seamlessly.
+//
+// Set the DRMIX_NOTE_CACHE_STATS environment variable to a file name to
+// append the hit rate (of all instances) to that file on exit.
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "WDL/heapbuf.h"
+
+#include "SawtoothSynth.h"
+
+enum EStartPhase
+{
+  kStartPhaseOff = 0, // No cache, free running oscillator/filter/LFO
+  kStartPhaseRetrigger, // Reset oscillator/filter/LFO on note on
+  kStartPhaseFreeLFO, // Reset oscillator/filter, LFO phase quantized
+
+  kNumStartPhases
+};
+
+struct NoteCacheKey
+{
+  int note;
+  unsigned int paramHash;
+  int startPhase;
+  int lfoStep; // Quantized LFO phase (kStartPhaseFreeLFO)
+  int quality;
+
+  bool operator==(const NoteCacheKey &key) const
+  {
+    return note == key.note && paramHash == key.paramHash && startPhase == key.startPhase && lfoStep == key.lfoStep && quality == key.quality;
+  }
+};
+
+// Modulation state (see SawtoothSynth::EnvelopeLevel() etc.)
+struct NoteCacheModulation
+{
+  float envelope;
+  float lfo;
+  float cutoff;
+  float resonance;
+};
+
+class NoteCache
+{
+public:
+  NoteCache() :
+    m_slots(NULL),
+    m_numSlots(0),
+    m_segmentLength(0),
+    m_budget(kDefaultBudget),
+    m_startPhase(kStartPhaseOff),
+    m_paramHash(0),
+    m_quality(kQualityFull),
+    m_clock(0),
+    m_playing(-1),
+    m_recording(-1),
+    m_position(0),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0),
+    m_catchUpSamples(0)
+  {}
+
+  ~NoteCache()
+  {
+    NoteCacheStats::Get().Add(m_hits, m_misses, m_evictions);
+    delete[] m_slots;
+  }
+
+  // (Re)allocates the cache, so not from the audio thread.
+  void SetSampleRate(double rate)
+  {
+    Cancel();
+
+    m_segmentLength = (int)(kSegmentTime * rate);
+    m_catchUp.Resize(m_segmentLength, false);
+
+    const int numSteps = m_segmentLength / kModulationStep + 1;
+
+    // Fit as many segments (and their end states) as the budget allows
+    int slotSize = (int)(m_segmentLength * sizeof(double) + numSteps * sizeof(NoteCacheModulation) + sizeof(Slot));
+    int numSlots = (int)(m_budget / slotSize);
+    if (numSlots < 1) numSlots = 1;
+
+    delete[] m_slots;
+    m_slots = new Slot[numSlots];
+    m_numSlots = numSlots;
+
+    m_samples.Resize(numSlots * m_segmentLength, false);
+    m_modulation.Resize(numSlots * numSteps, false);
+
+    for (int i = 0; i < numSlots; i++)
+    {
+      m_slots[i].samples = m_samples.Get() + i * m_segmentLength;
+      m_slots[i].modulation = m_modulation.Get() + i * numSteps;
+    }
+  }
+
+  // Memory budget in bytes, takes effect at the next SetSampleRate().
+  void SetBudget(size_t bytes) { m_budget = bytes; }
+
+  // When turned off during playback the synth catches up (at the next
+  // Process()), and continues live.
+  void SetStartPhase(int policy)
+  {
+    if (policy == kStartPhaseOff) Stop();
+    m_startPhase = policy;
+  }
+
+  int StartPhase() const { return m_startPhase; }
+
+  // Hash of all params (and anything else) that affect the rendered notes,
+  // entries rendered with other params are dropped.
+  void SetParamHash(unsigned int hash)
+  {
+    if (hash != m_paramHash) Invalidate();
+    m_paramHash = hash;
+  }
+
+  // Recordings are keyed by quality tier, and played back at the tier they
+  // were rendered at, but recording stops when the tier changes.
+  void SetQuality(int tier)
+  {
+    if (tier != m_quality && m_recording >= 0)
+    {
+      m_slots[m_recording].valid = false;
+      m_recording = -1;
+      m_position = 0;
+    }
+
+    m_quality = tier;
+  }
+
+  // Drops all entries, call Stop() first when playing back.
+  void Invalidate()
+  {
+    for (int i = 0; i < m_numSlots; i++) m_slots[i].valid = false;
+
+    if (m_recording >= 0)
+    {
+      m_recording = -1;
+      m_position = 0;
+    }
+  }
+
+  // Audio thread, after the synth's note on (frequency set and envelope
+  // attacked). Applies the start phase policy, and starts playing back (on
+  // a cache hit) or recording (on a miss).
+  void NoteOn(SawtoothSynth *pSynth, int note)
+  {
+    // The voice restarts, so no need to catch up, except for the LFO when
+    // it's free running
+    const int skip = m_playing >= 0 ? m_position : m_catchUpSamples;
+    if (skip > 0) pSynth->SkipLFO(skip);
+    Cancel();
+
+    if (m_startPhase == kStartPhaseOff || !m_numSlots) return;
+
+    NoteCacheKey key;
+    key.note = note;
+    key.paramHash = m_paramHash;
+    key.startPhase = m_startPhase;
+    key.lfoStep = 0;
+    key.quality = m_quality;
+
+    if (m_startPhase == kStartPhaseFreeLFO)
+    {
+      key.lfoStep = (int)(pSynth->LFOPhase() * kLFOSteps + 0.5f) % kLFOSteps;
+    }
+
+    pSynth->Retrigger((float)key.lfoStep / kLFOSteps);
+
+    // Find the entry, or else the least recently used one
+    int lru = 0;
+    for (int i = 0; i < m_numSlots; i++)
+    {
+      Slot *pSlot = &m_slots[i];
+      if (pSlot->valid && pSlot->key == key)
+      {
+        pSlot->lastUsed = ++m_clock;
+        m_playing = i;
+        m_hits++;
+        return;
+      }
+
+      // Prefer unused entries
+      const Slot *pLRU = &m_slots[lru];
+      if (!pSlot->valid ? pLRU->valid : pLRU->valid && pSlot->lastUsed < pLRU->lastUsed) lru = i;
+    }
+
+    Slot *pSlot = &m_slots[lru];
+    if (pSlot->valid) m_evictions++;
+
+    pSlot->valid = false;
+    pSlot->key = key;
+    pSlot->lastUsed = ++m_clock;
+    GetModulation(pSynth, &pSlot->modulation[0]);
+
+    m_recording = lru;
+    m_misses++;
+  }
+
+  // Audio thread, renders through the cache (instead of pSynth->Process()).
+  void Process(SawtoothSynth *pSynth, double *output, int samples, bool gate)
+  {
+    // Recordings are gated on, so continue live when that changes
+    if (!gate) Stop();
+
+    // Catch up after Stop(), still gated on like the recording was
+    if (m_catchUpSamples > 0)
+    {
+      pSynth->Process(m_catchUp.Get(), m_catchUpSamples, true);
+      m_catchUpSamples = 0;
+    }
+
+    if (m_playing >= 0)
+    {
+      Slot *pSlot = &m_slots[m_playing];
+
+      int n = m_segmentLength - m_position < samples ? m_segmentLength - m_position : samples;
+      memcpy(output, &pSlot->samples[m_position], n * sizeof(double));
+      m_position += n;
+
+      // Hand off to live rendering
+      if (m_position == m_segmentLength)
+      {
+        *pSynth = pSlot->endState;
+        pSynth->SetQuality(m_quality);
+        m_playing = -1;
+        m_position = 0;
+      }
+
+      output += n;
+      samples -= n;
+    }
+    else if (m_recording >= 0)
+    {
+      Slot *pSlot = &m_slots[m_recording];
+
+      int n = m_segmentLength - m_position < samples ? m_segmentLength - m_position : samples;
+
+      // In steps, recording the modulation state after each
+      for (int i = 0; i < n;)
+      {
+        int step = kModulationStep - m_position % kModulationStep;
+        if (step > n - i) step = n - i;
+
+        pSynth->Process(&output[i], step, gate);
+        memcpy(&pSlot->samples[m_position], &output[i], step * sizeof(double));
+        m_position += step;
+        i += step;
+
+        if (!(m_position % kModulationStep)) GetModulation(pSynth, &pSlot->modulation[m_position / kModulationStep]);
+      }
+
+      if (m_position == m_segmentLength)
+      {
+        pSlot->endState = *pSynth;
+        pSlot->valid = true;
+        m_recording = -1;
+        m_position = 0;
+      }
+
+      output += n;
+      samples -= n;
+    }
+
+    if (samples > 0) pSynth->Process(output, samples, gate);
+  }
+
+  // Continues live from here on, e.g. before changing params. When playing
+  // back, the next Process() first renders the synth up to the playback
+  // position (so not here, which may be outside the audio thread).
+  void Stop()
+  {
+    const int catchUp = m_playing >= 0 ? m_position : m_catchUpSamples;
+    Cancel();
+    m_catchUpSamples = catchUp;
+  }
+
+  // Stops playback (without catching up) and recording.
+  void Cancel()
+  {
+    if (m_recording >= 0) m_slots[m_recording].valid = false;
+
+    m_playing = m_recording = -1;
+    m_position = 0;
+    m_catchUpSamples = 0;
+  }
+
+  // Playing back, recording, or catching up, i.e. not just rendering live.
+  bool IsActive() const { return m_playing >= 0 || m_recording >= 0 || m_catchUpSamples > 0; }
+
+  // Modulation state after the last Process(), i.e. the synth's, or while
+  // playing back (when the synth is still at note on) the recorded state.
+  void Modulation(const SawtoothSynth *pSynth, NoteCacheModulation *pModulation) const
+  {
+    if (m_playing >= 0)
+      *pModulation = m_slots[m_playing].modulation[m_position / kModulationStep];
+    else
+      GetModulation(pSynth, pModulation);
+  }
+
+  unsigned int Hits() const { return m_hits; }
+  unsigned int Misses() const { return m_misses; }
+  double HitRate() const { return m_hits + m_misses ? (double)m_hits / (m_hits + m_misses) : 0.0; }
+
+  static const int kLFOSteps = 16;
+
+private:
+  // Totals of all instances, written once at exit (if enabled).
+  class NoteCacheStats
+  {
+  public:
+    static NoteCacheStats &Get()
+    {
+      static NoteCacheStats stats;
+      return stats;
+    }
+
+    void Add(unsigned int hits, unsigned int misses, unsigned int evictions)
+    {
+      m_instances++;
+      m_hits += hits;
+      m_misses += misses;
+      m_evictions += evictions;
+    }
+
+  private:
+    NoteCacheStats() : m_instances(0), m_hits(0), m_misses(0), m_evictions(0) {}
+
+    ~NoteCacheStats()
+    {
+      const char *path = getenv("DRMIX_NOTE_CACHE_STATS");
+      if (!path || !*path || !m_instances) return;
+
+      FILE *pFile = fopen(path, "a");
+      if (!pFile) return;
+
+      const unsigned int hits = m_hits, misses = m_misses;
+      fprintf(pFile, "Note cache: %u instance(s), %u hits, %u misses, %.1f%% hit rate, %u evictions\n",
+        (unsigned int)m_instances, hits, misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0, (unsigned int)m_evictions);
+      fclose(pFile);
+    }
+
+    std::atomic<unsigned int> m_instances, m_hits, m_misses, m_evictions;
+  };
+
+  struct Slot
+  {
+    Slot() : valid(false), lastUsed(0), samples(NULL), modulation(NULL) { memset(&key, 0, sizeof(key)); }
+
+    NoteCacheKey key;
+    bool valid;
+    unsigned int lastUsed;
+
+    double *samples;
+    NoteCacheModulation *modulation; // Every kModulationStep samples
+    SawtoothSynth endState;
+  };
+
+  static void GetModulation(const SawtoothSynth *pSynth, NoteCacheModulation *pModulation)
+  {
+    pModulation->envelope = pSynth->EnvelopeLevel();
+    pModulation->lfo = pSynth->LFOValue();
+    pModulation->cutoff = pSynth->FilterCutoff();
+    pModulation->resonance = pSynth->FilterResonance();
+  }
+
+  static constexpr double kSegmentTime = 0.2; // Seconds
+  static const size_t kDefaultBudget = 8 << 20; // 8 MB
+  static const int kModulationStep = 64; // Samples
+
+  Slot *m_slots;
+  int m_numSlots;
+  WDL_TypedBuf<double> m_samples, m_catchUp;
+  WDL_TypedBuf<NoteCacheModulation> m_modulation;
+  int m_segmentLength;
+  size_t m_budget;
+
+  int m_startPhase;
+  unsigned int m_paramHash;
+  int m_quality;
+  unsigned int m_clock;
+
+  int m_playing, m_recording;
+  int m_position;
+  int m_catchUpSamples; // Pending (after Stop()), rendered at the next Process()
+
+  unsigned int m_hits, m_misses, m_evictions;
+};
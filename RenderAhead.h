@@ -0,0 +1,210 @@
+#pragma once
+
+// Render-ahead for non-realtime (offline) bounce: after each block a worker
+// thread speculatively renders the synth's next block, on a copy of its
+// state, while the host is busy elsewhere. The next callback then only
+// copies the block out, unless a MIDI event, parameter change, etc. arrived
+// in between, in which case the speculative block is dropped, and the
+// callback renders serially (as usual).
+//
+// Set the DRMIX_RENDER_AHEAD_VERIFY environment variable to also render
+// each block serially, and check that both are bit-identical (in a host).
+// RenderAheadTest.cpp (nmake test) tests the same for a scripted session.
+//
+// The host's realtime/offline state isn't available to the plugin, so this
+// is switched on and off by a (saved) param. Leave it off for live playback,
+// where the callback would wait for the worker thread, i.e. turn it off again
+// after the bounce.
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "WDL/denormal.h"
+#include "WDL/heapbuf.h"
+
+#include "SawtoothSynth.h"
+
+class RenderAhead
+{
+public:
+  RenderAhead() :
+    m_enabled(false),
+    m_serial(0),
+    m_pending(false),
+    m_state(kIdle),
+    m_quit(false),
+    m_startSerial(0),
+    m_samples(0),
+    m_gate(false),
+    m_hits(0),
+    m_misses(0),
+    m_mismatches(0)
+  {
+    const char *verify = getenv("DRMIX_RENDER_AHEAD_VERIFY");
+    m_verify = verify && *verify && *verify != '0';
+  }
+
+  ~RenderAhead()
+  {
+    if (m_thread.joinable())
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+      }
+      m_cond.notify_one();
+      m_thread.join();
+    }
+  }
+
+  // Opt-in, as waiting for the worker thread isn't realtime safe.
+  void SetEnabled(bool enable)
+  {
+    if (enable && !m_thread.joinable()) m_thread = std::thread(&RenderAhead::Run, this);
+    m_enabled = enable;
+  }
+
+  bool IsEnabled() const { return m_enabled; }
+
+  // (Re)allocates the buffers, so not from the audio thread.
+  void SetBlockSize(int size)
+  {
+    Wait();
+    m_state = kIdle;
+    m_pending = false;
+
+    m_buffer.Resize(size, false);
+    if (m_verify) m_serialBuffer.Resize(size, false);
+  }
+
+  // Any thread, drops the block rendered ahead (if any) when the synth
+  // state or its input changes in any other way than rendering.
+  void Invalidate() { m_serial.fetch_add(1, std::memory_order_acq_rel); }
+
+  // Audio thread, starts rendering the next block, which is assumed to have
+  // no MIDI events (so the gate stays the same during the block).
+  void Start(const SawtoothSynth *pSynth, bool gate, int samples)
+  {
+    if (!m_enabled || samples > m_buffer.GetSize()) return;
+
+    Wait();
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+
+      m_synth = *pSynth;
+      m_gate = gate;
+      m_samples = samples;
+      m_startSerial = m_serial.load(std::memory_order_acquire);
+
+      m_state = kRequested;
+    }
+
+    m_pending = true;
+    m_cond.notify_one();
+  }
+
+  // Audio thread, if the block rendered ahead is still valid for the synth
+  // state, gate, and block size, then copies it to output, advances the
+  // synth state (as if it had rendered the block), and returns true.
+  bool Take(SawtoothSynth *pSynth, bool gate, double *output, int samples)
+  {
+    // Without locking, when nothing was started (e.g. render-ahead is off)
+    if (!m_pending) return false;
+    m_pending = false;
+
+    Wait();
+    m_state = kIdle;
+
+    if (m_startSerial != m_serial.load(std::memory_order_acquire) || gate != m_gate || samples != m_samples)
+    {
+      m_misses++;
+      return false;
+    }
+
+    if (m_verify)
+    {
+      double *serial = m_serialBuffer.Get();
+      pSynth->Process(serial, samples, gate);
+
+      bool identical = !memcmp(serial, m_buffer.Get(), samples * sizeof(double));
+      assert(identical);
+      if (!identical) m_mismatches++;
+    }
+
+    *pSynth = m_synth;
+    memcpy(output, m_buffer.Get(), samples * sizeof(double));
+
+    m_hits++;
+    return true;
+  }
+
+  unsigned int Hits() const { return m_hits; }
+  unsigned int Misses() const { return m_misses; }
+  unsigned int Mismatches() const { return m_mismatches; }
+
+private:
+  enum EState
+  {
+    kIdle = 0,
+    kRequested,
+    kRendered
+  };
+
+  void Wait()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_state == kRequested) m_done.wait(lock);
+  }
+
+  void Run()
+  {
+    // Same floating point mode as the audio thread, or else the results
+    // would differ
+    #ifdef WDL_DENORMAL_FTZMODE
+    WDL_denormal_ftz_scope denormalFtz;
+    #endif
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+      while (!m_quit && m_state != kRequested) m_cond.wait(lock);
+      if (m_quit) break;
+
+      lock.unlock();
+      m_synth.Process(m_buffer.Get(), m_samples, m_gate);
+      lock.lock();
+
+      m_state = kRendered;
+      m_done.notify_one();
+    }
+  }
+
+  std::atomic<bool> m_enabled;
+  std::atomic<unsigned int> m_serial;
+  bool m_pending; // Started, but not taken (audio thread only)
+
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_cond, m_done;
+  int m_state;
+  bool m_quit;
+
+  // Request, only touched by the worker while rendering
+  SawtoothSynth m_synth;
+  unsigned int m_startSerial;
+  int m_samples;
+  bool m_gate;
+  WDL_TypedBuf<double> m_buffer;
+
+  bool m_verify;
+  WDL_TypedBuf<double> m_serialBuffer;
+
+  unsigned int m_hits, m_misses, m_mismatches;
+};
@@ -0,0 +1,233 @@
+// Test of RenderAhead: plays a scripted host session (notes, param changes,
+// gate flips, block size changes, spurious invalidations) through the synth
+// twice, once serially and once with render-ahead, the same way
+// DrMixAISynth::ProcessDoubleReplacing() does, and fails unless both outputs
+// are bit-identical.
+//
+// Usage: RenderAheadTest [blocks]
+//
+// Build and run: nmake test (Windows), or
+// c++ -O2 -std=c++11 -pthread -I . RenderAheadTest.cpp -o RenderAheadTest && ./RenderAheadTest
+
+#include "RenderAhead.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// What the host does before (and during) a block.
+struct SessionBlock
+{
+  int samples;
+  int blockSize; // Host block size change (0 = none)
+
+  int param; // Param change (ESynthParams, -1 = none)
+  double value;
+
+  bool bypass; // Gate off
+  bool invalidate; // Spurious Invalidate()
+
+  int eventOffset; // MIDI event (-1 = none)
+  int note;
+  bool noteOn;
+
+  int hostTime; // Microseconds the host spends after the block
+};
+
+// Deterministic, so both passes (and every run) play the same session.
+class SessionRandom
+{
+public:
+  SessionRandom(uint32_t seed) : m_state(seed) {}
+
+  int Next(int range)
+  {
+    m_state = m_state * 1664525u + 1013904223u;
+    return (int)((m_state >> 8) % (uint32_t)range);
+  }
+
+private:
+  uint32_t m_state;
+};
+
+static void MakeSession(int numBlocks, std::vector<SessionBlock> *pSession)
+{
+  static const int blockSizes[] = { 512, 64, 256, 1000 };
+
+  SessionRandom rnd(1);
+  int blockSize = blockSizes[0], hostBlockSize = 0;
+  bool bypass = false;
+  int note = -1;
+
+  for (int b = 0; b < numBlocks; b++)
+  {
+    SessionBlock blk;
+    memset(&blk, 0, sizeof(blk));
+    blk.param = blk.eventOffset = -1;
+
+    // Now and then a new host block size, and the odd short block
+    if (b && !rnd.Next(150)) blockSize = blockSizes[rnd.Next(4)];
+    if (blockSize != hostBlockSize) blk.blockSize = hostBlockSize = blockSize;
+    blk.samples = rnd.Next(20) ? blockSize : 1 + rnd.Next(blockSize);
+
+    if (!rnd.Next(25))
+    {
+      blk.param = kSynthEnvelope + rnd.Next(kNumSynthParams - kSynthEnvelope);
+
+      const SynthParamInfo *pInfo = &kSynthParams[blk.param];
+      double t = rnd.Next(1001) / 1000.0;
+      blk.value = pInfo->type == kSynthParamBool ? (t < 0.5 ? 0.0 : 1.0) : pInfo->minValue + (pInfo->maxValue - pInfo->minValue) * t;
+    }
+
+    if (!rnd.Next(60)) bypass = !bypass;
+    blk.bypass = bypass;
+
+    blk.invalidate = !rnd.Next(40);
+
+    if (!rnd.Next(8))
+    {
+      blk.eventOffset = rnd.Next(blk.samples);
+      blk.noteOn = note < 0 || rnd.Next(2);
+      blk.note = blk.noteOn ? 36 + rnd.Next(48) : note;
+      note = blk.noteOn ? blk.note : -1;
+    }
+
+    // Sometimes the host is quick, so the callback has to wait for the
+    // worker thread
+    blk.hostTime = rnd.Next(3) ? 100 : 0;
+
+    pSession->push_back(blk);
+  }
+}
+
+static void PlaySession(const std::vector<SessionBlock> &session, bool renderAhead, std::vector<double> *pOutput, RenderAhead *pRenderAhead)
+{
+  #ifdef WDL_DENORMAL_FTZMODE
+  WDL_denormal_ftz_scope denormalFtz;
+  #endif
+
+  SawtoothSynth synth(44100);
+  synth.SetKernels(DSPKernels::Get(kDSPKernelsGeneric));
+  synth.SetParam(kSynthLFOAmplitude, 500, false);
+
+  RenderAhead &ahead = *pRenderAhead;
+  ahead.SetEnabled(renderAhead);
+
+  int noteOn = -1;
+  std::vector<double> output;
+
+  for (size_t b = 0; b < session.size(); b++)
+  {
+    const SessionBlock &blk = session[b];
+
+    // Host calls between callbacks
+    if (blk.blockSize) ahead.SetBlockSize(blk.blockSize);
+
+    if (blk.param >= 0)
+    {
+      synth.SetParam(blk.param, blk.value, noteOn >= 0);
+      ahead.Invalidate();
+    }
+
+    if (blk.invalidate) ahead.Invalidate();
+    if (blk.eventOffset >= 0) ahead.Invalidate();
+
+    // The callback
+    const int samples = blk.samples;
+    output.resize(samples);
+
+    bool gate = !blk.bypass && (noteOn >= 0 || !synth.EnvelopeIsBypassed());
+    int offset = ahead.Take(&synth, gate, &output[0], samples) ? samples : 0;
+
+    bool pending = blk.eventOffset >= 0;
+    while (offset < samples)
+    {
+      int next = samples;
+      if (pending)
+      {
+        if (blk.eventOffset > offset)
+        {
+          next = blk.eventOffset;
+        }
+        else
+        {
+          if (blk.noteOn)
+          {
+            synth.SetFrequency(pow(2, (double)(blk.note - 69) / 12) * 440);
+            synth.Attack();
+            noteOn = blk.note;
+          }
+          else if (blk.note == noteOn)
+          {
+            noteOn = -1;
+          }
+
+          pending = false;
+          continue;
+        }
+      }
+
+      gate = !blk.bypass && (noteOn >= 0 || !synth.EnvelopeIsBypassed());
+      synth.Process(&output[offset], next - offset, gate);
+      offset = next;
+    }
+
+    if (ahead.IsEnabled())
+    {
+      gate = !blk.bypass && (noteOn >= 0 || !synth.EnvelopeIsBypassed());
+      ahead.Start(&synth, gate, samples);
+    }
+
+    pOutput->insert(pOutput->end(), output.begin(), output.end());
+
+    if (blk.hostTime) std::this_thread::sleep_for(std::chrono::microseconds(blk.hostTime));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int numBlocks = argc > 1 ? atoi(argv[1]) : 3000;
+  if (numBlocks < 1) numBlocks = 1;
+
+  std::vector<SessionBlock> session;
+  MakeSession(numBlocks, &session);
+
+  std::vector<double> serial, ahead;
+  RenderAhead serialRenderAhead, renderAhead;
+
+  PlaySession(session, false, &serial, &serialRenderAhead);
+  PlaySession(session, true, &ahead, &renderAhead);
+
+  size_t mismatches = 0;
+  if (serial.size() != ahead.size())
+  {
+    mismatches = serial.size();
+  }
+  else
+  {
+    for (size_t i = 0; i < serial.size(); i++) mismatches += memcmp(&serial[i], &ahead[i], sizeof(double)) ? 1 : 0;
+  }
+
+  printf("%d blocks, %u rendered ahead, %u dropped, %u mismatching samples\n", numBlocks, renderAhead.Hits(), renderAhead.Misses(), (unsigned int)mismatches);
+
+  if (mismatches || renderAhead.Mismatches())
+  {
+    printf("FAILED: Render-ahead output differs from serial rendering\n");
+    return 1;
+  }
+
+  // Or else the test didn't test much
+  if (!renderAhead.Hits() || !renderAhead.Misses())
+  {
+    printf("FAILED: Session didn't exercise both rendering ahead and dropping\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
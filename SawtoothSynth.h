@@ -0,0 +1,436 @@
+#pragma once
+
+// The synth engine, free of any plugin (IPlug) dependencies, so it can also
+// be used by e.g. the batch renderer.
+
+#include <math.h>
+#include <string.h>
+
+#include "DSPKernels.h"
+
+enum EQualityTier
+{
+  kQualityFull = 0,
+  kQualityControlRate, // Filter/LFO at control rate
+  kQualityNoAntiAliasing, // Naive sawtooth, no anti-aliasing at all (aliases)
+  kQualityVoiceCap, // Steal decayed note tails
+
+  kNumQualityTiers
+};
+
+// The synth's params, shared by the plugin (they are the first of its
+// EParams) and the batch renderer. Values are in the plugin's units (ms, dB,
+// Hz), see SawtoothSynth::SetParam().
+enum ESynthParams
+{
+  kSynthBypass = 0,
+
+  kSynthEnvelope,
+  kSynthAttackTime,
+  kSynthDecayTime,
+  kSynthSustainLevel,
+  kSynthReleaseTime,
+
+  kSynthCutoffFrequency,
+  kSynthResonance,
+
+  kSynthLFOFrequency,
+  kSynthLFOAmplitude,
+
+  kNumSynthParams
+};
+
+enum ESynthParamType
+{
+  kSynthParamBool = 0,
+  kSynthParamLinear,
+  kSynthParamExp
+};
+
+struct SynthParamInfo
+{
+  const char *name;
+  int type; // ESynthParamType
+  double defaultValue, minValue, maxValue;
+  int shape; // Of exponential params
+  int displayPrecision;
+  const char *label;
+};
+
+static const SynthParamInfo kSynthParams[kNumSynthParams] =
+{
+  { "Bypass", kSynthParamBool, 0, 0, 1, 0, 0, "" },
+
+  { "Envelope", kSynthParamBool, 0, 0, 1, 0, 0, "" },
+  { "Attack", kSynthParamExp, 100, 1, 5000, 3, 0, "ms" },
+  { "Decay", kSynthParamExp, 200, 1, 5000, 3, 0, "ms" },
+  { "Sustain", kSynthParamLinear, -6.0, -72.0, 0.0, 0, 1, "dB" },
+  { "Release", kSynthParamExp, 300, 1, 5000, 3, 0, "ms" },
+
+  { "Cutoff", kSynthParamExp, 20000, 20, 20000, 6, 0, "Hz" },
+  { "Resonance", kSynthParamLinear, 0.5, 0.5, 4.0, 0, 1, "" },
+
+  { "LFO Rate", kSynthParamExp, 2, 0.1, 10, 3, 2, "Hz" },
+  { "LFO Depth", kSynthParamLinear, 0, 0, 1000, 0, 0, "Hz" }
+};
+
+class SawtoothOscillator {
+public:
+  SawtoothOscillator(float frequency, float sampleRate) : m_frequency(frequency), m_sampleRate(sampleRate) {
+    m_state.phase = 0.5;
+    m_state.phaseIncrement = frequency / sampleRate;
+    m_state.antiAliasing = true;
+  }
+
+  void reset() { m_state.phase = 0.5; }
+
+  void setAntiAliasing(bool antiAliasing) { m_state.antiAliasing = antiAliasing; }
+
+  void setFrequency(float frequency) {
+    m_frequency = frequency;
+    m_state.phaseIncrement = frequency / m_sampleRate;
+  }
+
+  void setSampleRate(float sampleRate) {
+    m_sampleRate = sampleRate;
+    m_state.phaseIncrement = m_frequency / sampleRate;
+  }
+
+  // Output a sawtooth wave between -1 and 1
+  void process(const DSPKernels *dsp, float *output, int samples) {
+    dsp->sawtooth(output, samples, &m_state);
+  }
+
+private:
+  float m_frequency;
+  float m_sampleRate;
+  SawtoothState m_state;
+};
+
+class LowPassFilter {
+public:
+  LowPassFilter(float cutoffFrequency, float resonance, float sampleRate) {
+    m_state.cutoffFrequency = cutoffFrequency;
+    m_state.resonance = resonance;
+    m_state.sampleRate = sampleRate;
+    m_state.cutoffFrequencyTarget = cutoffFrequency;
+    m_state.resonanceTarget = resonance;
+    m_state.controlRate = 1;
+    m_state.controlCounter = 0;
+
+    reset();
+    calculateSmoothingFactor();
+    LowPassCalculateCoefficients(&m_state);
+  }
+
+  void setResonance(float resonance) { m_state.resonanceTarget = resonance; }
+
+  // Jump to (instead of smoothly follow) cutoff frequency and resonance.
+  void snap(float cutoffFrequency) {
+    m_state.cutoffFrequency = m_state.cutoffFrequencyTarget = cutoffFrequency;
+    m_state.resonance = m_state.resonanceTarget;
+    m_state.controlCounter = 0;
+    LowPassCalculateCoefficients(&m_state);
+  }
+
+  // Smoothed (i.e. current) values
+  float getCutoffFrequency() const { return m_state.cutoffFrequency; }
+  float getResonance() const { return m_state.resonance; }
+
+  // Recalculate coefficients every sample (1), or at a lower control rate.
+  void setControlRate(int samples) {
+    m_state.controlRate = samples;
+
+    // Or else a higher rate only takes effect after the old count down
+    if (m_state.controlCounter > samples) m_state.controlCounter = samples;
+  }
+
+  void setSampleRate(float sampleRate) {
+    m_state.sampleRate = sampleRate;
+
+    reset();
+    calculateSmoothingFactor();
+    LowPassCalculateCoefficients(&m_state);
+  }
+
+  // Filter the input, with the cutoff frequency smoothly following the
+  // per-sample cutoff frequency target
+  void process(const DSPKernels *dsp, double *output, const float *input, const float *cutoff, int samples) {
+    dsp->lowPass(output, input, cutoff, samples, &m_state);
+  }
+
+  void reset() {
+    // Reset state variables to 0
+    m_state.x1 = m_state.x2 = m_state.y1 = m_state.y2 = 0.0;
+  }
+
+private:
+  void calculateSmoothingFactor() {
+    m_state.smoothingFactor = 1.0 - exp(-5.0 / (0.100 /* 100 ms */ * m_state.sampleRate));
+  }
+
+  LowPassFilterState m_state;
+};
+
+class SineLFO {
+public:
+  SineLFO(float frequency, float amplitude, float sampleRate) : m_frequency(frequency), m_amplitude(amplitude), m_sampleRate(sampleRate) {
+    m_phase = 0.0;
+    m_phaseIncrement = frequency / sampleRate;
+  }
+
+  void reset() { m_phase = 0.0; }
+
+  void setFrequency(float frequency) {
+    m_frequency = frequency;
+    m_phaseIncrement = frequency / m_sampleRate;
+  }
+
+  void setAmplitude(float amplitude) { m_amplitude = amplitude; }
+
+  void setSampleRate(float sampleRate) {
+    m_sampleRate = sampleRate;
+    m_phaseIncrement = m_frequency / m_sampleRate;
+  }
+
+  float getNextSample() {
+    float output = m_amplitude * sin(2.0 * M_PI * m_phase);
+    m_phase += m_phaseIncrement;
+    m_phase -= (int)m_phase;
+    return output;
+  }
+
+  void skip(int samples) {
+    m_phase += m_phaseIncrement * samples;
+    m_phase -= (int)m_phase;
+  }
+
+  // Next sample, without advancing
+  float getValue() const { return m_amplitude * sin(2.0 * M_PI * m_phase); }
+
+  float getPhase() const { return m_phase; }
+  void setPhase(float phase) { m_phase = phase; }
+
+private:
+  float m_frequency;
+  float m_amplitude;
+  float m_sampleRate;
+  float m_phase;
+  float m_phaseIncrement;
+};
+
+class SawtoothSynth
+{
+public:
+  SawtoothSynth(double sampleRate = 44100) :
+    m_dsp(DSPKernels::Default()),
+    m_sawtooth(440, sampleRate),
+
+    m_cutoffFrequency(1000),
+    m_filter(m_cutoffFrequency, 1.0, sampleRate), // A low-pass filter with initial cutoff frequency and resonance
+    m_lfo(2, 500, sampleRate), // An LFO with frequency 2 Hz, amplitude 500 Hz, and the same sample rate as the audio processing loop
+
+    m_envelopeBypass(true),
+
+    m_controlRate(1),
+    m_stealDecayedNote(false)
+  {
+    m_envelope.attackTime = 0.1;
+    m_envelope.decayTime = 0.2;
+    m_envelope.sustainLevel = 0.5;
+    m_envelope.releaseTime = 0.3;
+
+    m_envelope.sampleRate = sampleRate;
+    m_envelope.noteOnTime = 0.0;
+  }
+
+  // Force specific DSP kernels (e.g. for testing or benchmarking).
+  void SetKernels(const DSPKernels *dsp) { m_dsp = dsp; }
+  const DSPKernels *Kernels() const { return m_dsp; }
+
+  void SetSampleRate(double rate)
+  {
+    m_sawtooth.setSampleRate(rate);
+    m_filter.setSampleRate(rate);
+    m_lfo.setSampleRate(rate);
+    m_envelope.sampleRate = rate;
+  }
+
+  void SetFrequency(double frequency) { m_sawtooth.setFrequency(frequency); }
+
+  void BypassEnvelope(bool bypass, bool gate)
+  {
+    if (!bypass && m_envelopeBypass && gate) Attack();
+    m_envelopeBypass = bypass;
+  }
+
+  bool EnvelopeIsBypassed() { return m_envelopeBypass; }
+
+  void SetAttackTime(double attack) { m_envelope.attackTime = attack; }
+  void SetDecayTime(double decay) { m_envelope.decayTime = decay; }
+  void SetSustainLevel(double sustain) { m_envelope.sustainLevel = sustain; }
+  void SetReleaseTime(double release) { m_envelope.releaseTime = release; }
+
+  void SetCutoffFrequency(double cutoff) { m_cutoffFrequency = cutoff; }
+  void SetResonance(double resonance) { m_filter.setResonance(resonance); }
+
+  void SetLFOFrequency(double frequency) { m_lfo.setFrequency(frequency); }
+  void SetLFOAmplitude(double amplitude) { m_lfo.setAmplitude(amplitude); }
+
+  // Sets a synth param (ESynthParams) in the plugin's units. Bypass isn't a
+  // synth setting, it's up to the caller to turn the gate off.
+  void SetParam(int index, double value, bool gate)
+  {
+    switch (index)
+    {
+      case kSynthEnvelope: BypassEnvelope(value < 0.5, gate); break;
+      case kSynthAttackTime: SetAttackTime(value * 0.001); break;
+      case kSynthDecayTime: SetDecayTime(value * 0.001); break;
+      // dB, converted the same way as IPlug's DBToAmp() (IAMP_DB)
+      case kSynthSustainLevel: SetSustainLevel(exp(0.11512925464970 * value)); break;
+      case kSynthReleaseTime: SetReleaseTime(value * 0.001); break;
+
+      case kSynthCutoffFrequency: SetCutoffFrequency(value); break;
+      case kSynthResonance: SetResonance(value); break;
+
+      case kSynthLFOFrequency: SetLFOFrequency(value); break;
+      case kSynthLFOAmplitude: SetLFOAmplitude(value); break;
+    }
+  }
+
+  // Trade quality for CPU (see CPUGovernor), each tier includes the ones
+  // before it.
+  void SetQuality(int tier)
+  {
+    m_controlRate = tier >= kQualityControlRate ? kControlRate : 1;
+    m_filter.setControlRate(m_controlRate);
+
+    // There is no cheaper anti-aliasing than PolyBLEP to fall back to (it
+    // only touches the 2 samples around each wrap), so this tier simply
+    // drops it, and the sawtooth aliases. It saves little, but it's the
+    // only thing left to trade before the voice cap.
+    m_sawtooth.setAntiAliasing(tier < kQualityNoAntiAliasing);
+
+    // This synth only has a single voice, so the voice cap is 0 for notes
+    // that have decayed (i.e. their release tail is stolen).
+    m_stealDecayedNote = tier >= kQualityVoiceCap;
+  }
+
+  // Modulation state after the last Process() (e.g. for the scope).
+  float EnvelopeLevel() const { return m_envelopeBypass ? 1.0f : EnvelopeValue(-m_envelope.noteOnTime, &m_envelope); }
+  float LFOValue() const { return m_lfo.getValue(); }
+  float FilterCutoff() const { return m_filter.getCutoffFrequency(); }
+  float FilterResonance() const { return m_filter.getResonance(); }
+
+  void Reset()
+  {
+    m_sawtooth.reset();
+    m_sawtooth.setFrequency(0);
+
+    m_filter.reset();
+    m_lfo.reset();
+
+    m_envelope.noteOnTime = 0.0;
+  }
+
+  void Attack() { m_envelope.noteOnTime = 0.0; }
+
+  // Restart the voice from a known state (see NoteCache): oscillator and
+  // filter reset, and the LFO at the given phase.
+  void Retrigger(float lfoPhase)
+  {
+    m_sawtooth.reset();
+    m_lfo.setPhase(lfoPhase);
+
+    m_filter.reset();
+    m_filter.snap(m_cutoffFrequency + m_lfo.getValue());
+  }
+
+  float LFOPhase() const { return m_lfo.getPhase(); }
+  void SkipLFO(int samples) { m_lfo.skip(samples); }
+
+  void Process(double *output, int samples, bool gate)
+  {
+    // The synthesizer's rendering loop, in chunks that fit the DSP kernels'
+    // buffers
+    float sample[kChunkSize], envelope[kChunkSize], cutoff[kChunkSize];
+
+    for (int offset = 0; offset < samples; offset += kChunkSize)
+    {
+      int chunk = samples - offset < kChunkSize ? samples - offset : kChunkSize;
+
+      if (m_stealDecayedNote && NoteHasDecayed(offset))
+      {
+        memset(&output[offset], 0, (samples - offset) * sizeof(double));
+        m_lfo.skip(samples - offset);
+        break;
+      }
+
+      m_sawtooth.process(m_dsp, sample, chunk);
+
+      // Calculate the envelope value for each sample
+      const float *pEnvelope = NULL;
+      if (!m_envelopeBypass)
+      {
+        m_dsp->envelope(envelope, chunk, offset, &m_envelope);
+        pEnvelope = envelope;
+      }
+
+      m_dsp->amplify(sample, pEnvelope, gate ? 0.25f /* -12 dB */ : 0.0f, chunk);
+
+      // Set the filter cutoff frequency to the initial value plus the LFO output
+      if (m_controlRate == 1)
+      {
+        for (int i = 0; i < chunk; i++)
+        {
+          cutoff[i] = m_cutoffFrequency + m_lfo.getNextSample();
+        }
+      }
+      else
+      {
+        for (int i = 0; i < chunk; i += m_controlRate)
+        {
+          int n = chunk - i < m_controlRate ? chunk - i : m_controlRate;
+
+          float value = m_cutoffFrequency + m_lfo.getNextSample();
+          m_lfo.skip(n - 1);
+
+          for (int j = 0; j < n; j++) cutoff[i + j] = value;
+        }
+      }
+
+      // Filter the input using the modified cutoff frequency
+      m_filter.process(m_dsp, &output[offset], sample, cutoff, chunk);
+    }
+
+    m_envelope.noteOnTime -= samples / m_envelope.sampleRate;
+  }
+
+private:
+  // Envelope past decay and below -60 dB
+  bool NoteHasDecayed(int start)
+  {
+    if (m_envelopeBypass) return false;
+
+    float deltaTime = start / m_envelope.sampleRate - m_envelope.noteOnTime;
+    return deltaTime >= m_envelope.attackTime + m_envelope.decayTime &&
+      EnvelopeValue(deltaTime, &m_envelope) < 0.001f;
+  }
+
+  static const int kChunkSize = 64;
+  static const int kControlRate = 16;
+
+  const DSPKernels *m_dsp;
+
+  SawtoothOscillator m_sawtooth;
+
+  float m_cutoffFrequency;
+  LowPassFilter m_filter;
+  SineLFO m_lfo;
+
+  bool m_envelopeBypass;
+  EnvelopeState m_envelope; // ADSR parameters
+
+  int m_controlRate;
+  bool m_stealDecayedNote;
+};
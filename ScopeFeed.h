@@ -0,0 +1,228 @@
+#pragma once
+
+// Lock-free feed of the (decimated) output and modulation state from the
+// audio thread to the scope in the GUI, or any other consumer. The audio
+// thread never waits: the rings overwrite their oldest data, and readers
+// retry if data was overwritten while they were copying it. All analysis
+// (spectrum, filter response) is left to the reader.
+
+#include <atomic>
+
+struct ScopeSnapshot
+{
+  unsigned int position; // Decimated samples published so far
+  float envelope; // 0..1
+  float lfo; // Cutoff offset (Hz)
+  float cutoff; // Smoothed cutoff frequency (Hz)
+  float resonance;
+  bool gate;
+  float noteCacheHitRate; // 0..1, or < 0 while the note cache is off
+};
+
+// Single writer, multiple reader ring that overwrites its oldest items
+// (seqlock style).
+template <class T, unsigned int kSize> class ScopeRing
+{
+public:
+  ScopeRing() : m_claimed(0), m_written(0) {}
+
+  // Audio thread, wait-free, count <= kSize.
+  void Write(const T *data, unsigned int count)
+  {
+    unsigned int write = m_written.load(std::memory_order_relaxed);
+
+    m_claimed.store(write + count, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // In (up to) 2 contiguous parts
+    unsigned int pos = write & (kSize - 1);
+    unsigned int part = kSize - pos < count ? kSize - pos : count;
+    for (unsigned int i = 0; i < part; i++) m_data[pos + i] = data[i];
+    for (unsigned int i = part; i < count; i++) m_data[i - part] = data[i];
+
+    m_written.store(write + count, std::memory_order_release);
+  }
+
+  // Any thread, copies the (up to) count most recent items, oldest first,
+  // and returns the number of items copied.
+  unsigned int Read(T *data, unsigned int count) const
+  {
+    if (count > kSize) count = kSize;
+
+    for (int retry = 0; retry < 4; retry++)
+    {
+      unsigned int end = m_written.load(std::memory_order_acquire);
+      unsigned int n = end < count ? end : count;
+      unsigned int start = end - n;
+
+      for (unsigned int i = 0; i < n; i++) data[i] = m_data[(start + i) & (kSize - 1)];
+
+      // Valid if the writer hasn't started overwriting the oldest item
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (m_claimed.load(std::memory_order_relaxed) - start <= kSize) return n;
+    }
+
+    return 0;
+  }
+
+private:
+  T m_data[kSize];
+  std::atomic<unsigned int> m_claimed, m_written;
+};
+
+class ScopeFeed
+{
+public:
+  ScopeFeed() :
+    m_decimation(2),
+    m_sampleRate(22050),
+    m_sum(0.0),
+    m_count(0),
+    m_position(0)
+  {}
+
+  // Decimate to about 22 kHz, which is plenty for display.
+  void SetSampleRate(double rate)
+  {
+    m_decimation = (int)(rate / 22050 + 0.5);
+    if (m_decimation < 1) m_decimation = 1;
+
+    m_sampleRate = rate / m_decimation;
+    m_sum = 0.0;
+    m_count = 0;
+  }
+
+  // Sample rate of the published samples.
+  double SampleRate() const { return m_sampleRate; }
+
+  // Audio thread, once per block, wait-free and allocation free. The cost is
+  // bounded: of larger blocks only the most recent (up to) kMaxPublish input
+  // samples are published, i.e. the samples have a gap before them.
+  void Publish(const double *output, int samples, ScopeSnapshot snapshot)
+  {
+    // Box filter decimation, continued across blocks
+    const int decimation = m_decimation;
+    const double scale = 1.0 / decimation;
+
+    const int maxSamples = kMaxPublish / decimation * decimation;
+    if (samples > maxSamples)
+    {
+      // Whole groups, so the group in progress is dropped
+      output += samples - maxSamples;
+      samples = maxSamples;
+
+      m_sum = 0.0;
+      m_count = 0;
+    }
+
+    float buf[kChunkSize];
+    int i = 0, n = 0;
+
+    if (m_count)
+    {
+      // Finish the group started in the previous block
+      for (; i < samples && m_count < decimation; i++, m_count++) m_sum += output[i];
+
+      if (m_count == decimation)
+      {
+        buf[n++] = (float)(m_sum * scale);
+        m_sum = 0.0;
+        m_count = 0;
+      }
+    }
+
+    while (i + decimation <= samples)
+    {
+      int count = (samples - i) / decimation;
+      if (count > kChunkSize - n) count = kChunkSize - n;
+
+      BoxFilter(&output[i], &buf[n], count, decimation, scale);
+      i += count * decimation;
+      n += count;
+
+      m_samples.Write(buf, n);
+      m_position += n;
+      n = 0;
+    }
+
+    if (n)
+    {
+      m_samples.Write(buf, n);
+      m_position += n;
+    }
+
+    // Start the next group
+    for (; i < samples; i++, m_count++) m_sum += output[i];
+
+    snapshot.position = m_position;
+    m_snapshots.Write(&snapshot, 1);
+  }
+
+  // Any thread, the count most recent samples (oldest first), returns the
+  // number of samples read.
+  int ReadSamples(float *samples, int count) const { return m_samples.Read(samples, count); }
+
+  // Any thread, the most recent modulation state.
+  bool ReadSnapshot(ScopeSnapshot *pSnapshot) const { return m_snapshots.Read(pSnapshot, 1) == 1; }
+
+  static const int kMaxSamples = 8192;
+  static const int kMaxPublish = 2048; // Input samples per block
+
+  // Publish() time limit, checked by ScopeFeedBench.cpp (nmake bench)
+  static const int kPublishBudget = 4000; // ns/block (of any size)
+
+private:
+  static const int kChunkSize = 256;
+
+  // Averages count groups of decimation input samples, with the common
+  // decimations unrolled.
+  static void BoxFilter(const double *input, float *output, int count, int decimation, double scale)
+  {
+    switch (decimation)
+    {
+      case 1: BoxFilter<1>(input, output, count, scale); break;
+      case 2: BoxFilter<2>(input, output, count, scale); break;
+      case 4: BoxFilter<4>(input, output, count, scale); break;
+
+      default:
+      {
+        // In 2 sums, halving the chain of dependent adds
+        for (int j = 0; j < count; j++, input += decimation)
+        {
+          double sum0 = 0.0, sum1 = 0.0;
+
+          int k = 0;
+          for (; k + 1 < decimation; k += 2)
+          {
+            sum0 += input[k];
+            sum1 += input[k + 1];
+          }
+          if (k < decimation) sum0 += input[k];
+
+          output[j] = (float)((sum0 + sum1) * scale);
+        }
+        break;
+      }
+    }
+  }
+
+  template <int kDecimation> static void BoxFilter(const double *input, float *output, int count, double scale)
+  {
+    for (int j = 0; j < count; j++, input += kDecimation)
+    {
+      double sum = 0.0;
+      for (int k = 0; k < kDecimation; k++) sum += input[k];
+      output[j] = (float)(sum * scale);
+    }
+  }
+
+  ScopeRing<float, kMaxSamples> m_samples;
+  ScopeRing<ScopeSnapshot, 64> m_snapshots;
+
+  int m_decimation;
+  double m_sampleRate;
+
+  double m_sum;
+  int m_count;
+  unsigned int m_position;
+};
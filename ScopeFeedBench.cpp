@@ -0,0 +1,105 @@
+// Benchmark of ScopeFeed::Publish(): publishes representative host block
+// sizes at common sample rates, and fails if the mean or the 99th percentile
+// of the time per block exceeds ScopeFeed::kPublishBudget, the same for any
+// block size (Publish() bounds its work per block).
+//
+// Every block is timed on its own, after a warm-up round. The percentile
+// leaves out preemption by the OS (which on a busy or virtual machine hits
+// more than 1 in 1000 blocks), the true max is only reported.
+//
+// Usage: ScopeFeedBench [blocks]
+//
+// Build and run: nmake bench (Windows), or
+// c++ -O2 -std=c++11 -I . ScopeFeedBench.cpp -o ScopeFeedBench && ./ScopeFeedBench
+
+#include "ScopeFeed.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv)
+{
+  typedef std::chrono::steady_clock Clock;
+
+  static const double sampleRates[] = { 44100, 48000, 96000, 192000 };
+  static const int blockSizes[] = { 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384 };
+
+  int numBlocks = argc > 1 ? atoi(argv[1]) : 10000;
+  if (numBlocks < 1) numBlocks = 1;
+
+  // A second of synth-like output
+  std::vector<double> input(192000);
+  for (size_t i = 0; i < input.size(); i++) input[i] = 0.25 * sin(0.0314 * i);
+
+  static ScopeFeed feed;
+  std::vector<float> scope(ScopeFeed::kMaxSamples);
+  std::vector<long long> times(numBlocks);
+
+  const long long budget = ScopeFeed::kPublishBudget;
+  int failed = 0;
+
+  printf("%8s %6s %10s %10s %10s %10s\n", "Rate", "Block", "Mean (ns)", "99% (ns)", "Max (ns)", "Budget");
+
+  for (size_t r = 0; r < sizeof(sampleRates) / sizeof(sampleRates[0]); r++)
+  {
+    for (size_t b = 0; b < sizeof(blockSizes) / sizeof(blockSizes[0]); b++)
+    {
+      const int samples = blockSizes[b];
+      feed.SetSampleRate(sampleRates[r]);
+
+      // Warm-up round, then the timed round
+      for (int round = 0; round < 2; round++)
+      {
+        size_t pos = 0;
+
+        for (int i = 0; i < numBlocks; i++)
+        {
+          if (pos + samples > input.size()) pos = 0;
+
+          ScopeSnapshot snapshot;
+          snapshot.envelope = 1.0f;
+          snapshot.lfo = 0.0f;
+          snapshot.cutoff = 1000.0f;
+          snapshot.resonance = 1.0f;
+          snapshot.gate = true;
+
+          Clock::time_point start = Clock::now();
+          feed.Publish(&input[pos], samples, snapshot);
+          times[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+          pos += samples;
+
+          // Keep a reader busy now and then, as the GUI would
+          if (!(i & 63)) feed.ReadSamples(&scope[0], ScopeFeed::kMaxSamples);
+        }
+      }
+
+      double mean = 0.0;
+      for (int i = 0; i < numBlocks; i++) mean += times[i];
+      mean /= numBlocks;
+
+      std::sort(times.begin(), times.end());
+      long long percentile = times[(size_t)(numBlocks - 1) * 99 / 100];
+      long long max = times[numBlocks - 1];
+
+      bool ok = mean <= budget && percentile <= budget;
+      if (!ok) failed++;
+
+      printf("%8.0f %6d %10.0f %10lld %10lld %10lld%s\n", sampleRates[r], samples, mean, percentile, max, budget, ok ? "" : "  FAILED");
+    }
+  }
+
+  if (failed)
+  {
+    printf("FAILED: %d case(s) over budget\n", failed);
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}